@@ -1,7 +1,56 @@
 #include <iostream>
 #include <vector>
 #include <stack>
+#include <algorithm>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <iomanip>
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <span>
+#include <memory>
+#include <string_view>
+#include <functional>
+#include <csetjmp>
+#include <optional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <bit>
+#include <random>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <csignal>
+
+// Used for slow paths called from the interpreter loops, so they don't bloat the hot code
+#if defined(__GNUC__)
+#define BF_NOINLINE __attribute__((noinline))
+#else
+#define BF_NOINLINE
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BF_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define BF_HAVE_AVX2 0
+#endif
+
+#if defined(__x86_64__) && defined(__linux__)
+#define BF_HAVE_JIT 1
+#else
+#define BF_HAVE_JIT 0
+#endif
 
 // 1. Optimizations are valuable when dealing with repetitive instructions, loops and operations that affect multiple cells,
 //    like memory initialization, but also trivial operations, adjacent pointer movements, and adjacent input/output operations.
@@ -14,260 +63,4817 @@
 //    faster execution.
 
 // Optimizations applied:
+// - Compile while streaming the source in chunks, dropping comments immediately (`Compiler`)
+//   with jump targets linked inline; unmatched brackets become TRAPs that only fail when taken
 // - Combine repeated operations (e.g., `+++` → `INC_VAL 3`)
 // - Combine repeated pointer movements (e.g., `>>><<>` → `INC_PTR 2`)
 // - Collapse zero-setting loops (e.g., `[-]` → `SET_ZERO`)
 // - Collapse adjacent input/output operations (e.g., `..` → `OUTPUT 2`)
+// - Collapse multiply/copy loops (e.g., `[->++>+<<]` → `MUL_ADD 2@1`, `MUL_ADD 1@2`, `SET_ZERO`), also
+//   with counter steps other than -1, whose iteration count is solved modulo the cell width
+// - Fold pointer movements inside straight-line code into cell offsets (e.g., `>+>>-<<<.` → `INC_VAL 1@1`,
+//   `DEC_VAL 1@3`, `OUTPUT 1`), with one net pointer adjustment before the next loop boundary
+// - Collapse clears of adjacent cells (e.g., `[-]>[-]>[-]` → `CLEAR_RANGE 3`), executed with memset
+// - Collapse equal adds to adjacent cells (e.g., `+>+>+>+` → `VEC_ADD 1x4`), executed with SSE2
+// - Collapse pointer-scan loops (e.g., `[>>>>>>>>>]` → `SCAN 9`), executed with memchr/memrchr or SIMD
+// - Track known cell values from the zero tape on to drop loops that are never entered (e.g. right
+//   after `]`), clears of cells that are already zero, and MUL_ADDs with a known factor
+// - Evaluate the program up to its first input at compile time and start from the resulting tape (-O3)
+// - Fuse the most frequently executed opcode pairs into super-instructions (e.g., MUL_ADD + SET_ZERO →
+//   `MUL_CLEAR`, INC_PTR + LOOP_END → `SHIFT_LOOP_END`), picked with the pair counts of `--profile`
+// The passes are run by a pass manager until none of them changes the bytecode any more (`PassManager`),
+// selected with `-O0`..`-O3` and `--pass=`; `--time-passes` reports what each pass cost and removed.
+
+// `--bench` times the read, compile, optimize and execute phases per -O level and engine (CSV/JSON).
+
+// `--batch` compiles once and runs the program over many input files on a thread pool (`run_batch`).
+
+// `--fuzz` compares random programs on every -O level, pass set and engine against a reference interpreter of the
+// source and minimizes the first mismatch (`run_fuzz`).
+
+// `--profile` counts executions per instruction, loop and opcode pair and maps hot loops back to source positions.
+
+// `--max-iterations=` and `--timeout=` stop runaway programs, counting only at loop back-edges (`Watchdog`);
+// loops that provably never end once entered become errors on entry (`trap_endless_loops`).
+
+// `--checkpoint=` saves the tape, pointer, position and I/O offsets of a run at a back-edge on a signal or
+// every n iterations, and `--resume=` continues from the file (`Checkpoint`, `write_checkpoint`).
+
+// `--stats` writes cheap aggregate counters of a run (dispatches, loop iterations, tape pages, I/O bytes, phase
+// times) as JSON; the counting interpreters are separate instantiations, so the default ones pay nothing (`Stats`).
+
+// Optimized bytecode can be written to a file (`--emit=`) or a cache keyed by a source hash (`--cache=`)
+// and is then memory-mapped and run without compiling (`MappedBytecode`).
+
+// `--emit-c=` writes the optimized bytecode as a standalone C program for ahead-of-time compilation (`emit_c`).
+
+// The tape is a lazily populated 1 GiB mapping between guard regions, so the engines need no bounds
+// checks and running off the tape is an error instead of memory corruption (`Tape`). Its 4 KiB pages
+// are allocated on first touch, so sparse programs pay for the cells they touch, not for the pointer
+// range; `--tape-size=` reserves more address space for larger excursions.
+
+// `--checked` runs without the guard pages' SIGSEGV handler: one range check per region of code, none inside loops
+// that return the pointer to where they started (`insert_range_checks`), and per-access checks only after one fails.
+
+// Cells are 8, 16 or 32 bits wide (`--cell-bits=`), with one interpreter instantiation per width.
+
+// Program I/O goes through user-space buffers over read(2)/write(2) (`Output`, `Input`) instead of iostreams.
 
-enum Bytecode {
+// Execution engines (`--engine=`):
+// - switch: portable `switch` dispatch loop (`interpret_bytecode`)
+// - threaded: direct-threaded code with one indirect jump per handler (`interpret_threaded`, GCC/Clang only)
+// - jit: x86-64 machine code emitted into an executable mapping (`interpret_jit`, x86-64 Linux only)
+// - tiered: -O1 interpreter that JIT-compiles hot loops at the full -O level (`interpret_tiered`)
+
+enum Bytecode : uint8_t {
     INC_PTR,
     DEC_PTR,
     INC_VAL,
     DEC_VAL,
     OUTPUT,
     INPUT,
-    LOOP_START,
-    LOOP_END,
+    LOOP_START,         // `value` is the index of the matching LOOP_END, `offset` the source position of `[`
+    LOOP_END,           // `value` is the index of the matching LOOP_START, `offset` the source position of `]`
     SET_ZERO,           // Optimization for `[-]` pattern
-    CLEAR_RANGE,        // Optimization for clearing a range of cells to zero
+    CLEAR_RANGE,        // Optimization for clearing `value` cells starting at ptr + offset to zero
+    MUL_ADD,            // memory[ptr + offset] += value * memory[ptr + source], from multiply/copy loops
+    SCAN,               // Move ptr by `value` (signed stride) until memory[ptr] == 0, from `[>]`, `[<<]`, ...
+    VEC_ADD,            // memory[ptr + offset + k] += value for k < source, from `+>+>+>+` after offset folding
+    TRAP,               // Unmatched bracket `value` ('[' or ']') at source position `offset`: an error
+                        // if its jump would be taken, i.e. memory[ptr] == 0 for '[' and != 0 for ']'.
+                        // 'L' (like ']') marks the entry of a loop that never ends, see trap_endless_loops()
+    // Super-instructions for the most frequent dynamic pairs, formed by the final `fuse` pass
+    MUL_CLEAR,          // MUL_ADD followed by SET_ZERO of its source cell, the tail of a multiply loop
+    SHIFT_LOOP_END,     // ptr += `source`, then LOOP_END: the pointer move at the end of a loop body
+    CHECK,              // Cells ptr + offset ..= ptr + value are on the tape, see insert_range_checks()
 };
+static const unsigned bytecode_count = CHECK + 1;  // keep in sync with the last opcode
+
+// Whether `op` closes a loop, i.e. is the LOOP_END half of a LOOP_START link
+static inline bool closes_loop(Bytecode op) {
+    return op == LOOP_END || op == SHIFT_LOOP_END;
+}
 
+// Cell-accessing instructions address memory[ptr + offset]; LOOP_START/LOOP_END/TRAP always test
+// memory[ptr] and keep their source position in `offset` for `--profile` and error messages.
+// The record is packed into 12 bytes (the MUL_ADD source fills the padding after the opcode) and
+// loops carry their jump target inline, so the interpreters touch a single array.
 struct Instruction {
-    Bytecode op;
-    int value;  // for repeated operations, default 1
+    Bytecode op = INC_PTR;
+    int16_t source = 0;  // cell read by MUL_ADD relative to ptr, cell count of VEC_ADD
+    int32_t value = 0;   // for repeated operations, default 1
+    int32_t offset = 0;  // accessed cell relative to ptr
+
+    Instruction() = default;
+    Instruction(Bytecode op, int value, int offset = 0, int source = 0)
+        : op(op), source(int16_t(source)), value(value), offset(offset) {}
+
+    bool operator==(const Instruction&) const = default;
 };
+static_assert(sizeof(Instruction) == 12, "Instruction should stay packed");
 
-// Compiles Brainfuck code to optimized bytecode
-std::vector<Instruction> compile_to_bytecode(const std::string& program) {
-    std::vector<Instruction> bytecode;
-    std::stack<int> loop_stack;  // matches LOOP_START with LOOP_END
+// Whether a MUL_ADD source offset can be encoded in Instruction::source
+static bool fits_source(int offset) {
+    return offset >= INT16_MIN && offset <= INT16_MAX;
+}
 
-    size_t program_size = program.size();
-    char cmd;
-    int count;
-    for (size_t i = 0; i < program_size; ++i) {
-        cmd = program[i];
-        count = 1;
-        switch (cmd) {
-            case '>': {
-                while (i + 1 < program_size && program[i + 1] == '>') { ++count; ++i; }
-                bytecode.push_back({INC_PTR, count});
-                break;
-            }
-            case '<': {
-                while (i + 1 < program_size && program[i + 1] == '<') { ++count; ++i; }
-                bytecode.push_back({DEC_PTR, count});
-                break;
-            }
-            case '+': {
-                while (i + 1 < program_size && program[i + 1] == '+') { ++count; ++i; }
-                bytecode.push_back({INC_VAL, count});
-                break;
-            }
-            case '-': {
-                while (i + 1 < program_size && program[i + 1] == '-') { ++count; ++i; }
-                bytecode.push_back({DEC_VAL, count});
-                break;
-            }
-            case '.': {
-                while (i + 1 < program_size && program[i + 1] == '.') { ++count; ++i; }
-                bytecode.push_back({OUTPUT, count});
-                break;
+// Whether a loop whose body is just `instr` clears memory[ptr] (`[-]`, `[+]`, `[---]`, ...): adding an
+// odd amount reaches zero from every value at every cell width, an even amount only from some
+static bool is_clear_body(const Instruction& instr) {
+    return (instr.op == INC_VAL || instr.op == DEC_VAL) && instr.offset == 0 && (instr.value & 1) != 0;
+}
+
+// Whether the jump of the unmatched `bracket` of a TRAP is taken on a cell holding `cell`
+template <class Cell>
+static inline bool trap_taken(int bracket, Cell cell) {
+    return (cell == 0) == (bracket == '[');
+}
+
+// Compiles Brainfuck code to bytecode incrementally: feed() accepts the source in arbitrary chunks
+// and drops non-command bytes immediately, so only the bytecode is ever held in memory. Runs of
+// `+`/`-` and `>`/`<` are folded into their net effect and `[-]` is turned into SET_ZERO as soon as
+// its `]` arrives, even when comments separate the commands (as are `[+]`, `[---]` and other odd
+// steps). Loops are linked as their `]` arrives, so the bytecode is complete after one pass over
+// the source. Unmatched brackets are valid as long as their jump is never taken (`+[` is a
+// program): they become TRAPs, which only fail when they are reached with the jump condition true.
+class Compiler {
+public:
+    void feed(const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i, ++position) {
+            char cmd = data[i];
+            switch (cmd) {
+                case '+': case '-':
+                    if (pending != VALUE) flush();
+                    pending = VALUE;
+                    pending_count += (cmd == '+') ? 1 : -1;
+                    break;
+                case '>': case '<':
+                    if (pending != POINTER) flush();
+                    pending = POINTER;
+                    pending_count += (cmd == '>') ? 1 : -1;
+                    break;
+                case '.': case ',': {
+                    Pending kind = (cmd == '.') ? WRITE : READ;
+                    if (pending != kind) flush();
+                    pending = kind;
+                    ++pending_count;
+                    break;
+                }
+                case '[':
+                    flush();
+                    loop_stack.push_back(bytecode.size());
+                    bytecode.push_back({LOOP_START, 0, source_offset()});
+                    break;
+                case ']': {
+                    flush();
+                    if (loop_stack.empty()) {
+                        bytecode.push_back({TRAP, ']', source_offset()});
+                        break;
+                    }
+                    size_t start = loop_stack.back();
+                    loop_stack.pop_back();
+                    if (start + 2 == bytecode.size() && is_clear_body(bytecode.back())) {
+                        bytecode.pop_back();
+                        bytecode.back() = {SET_ZERO, 1};
+                    } else {
+                        bytecode[start].value = int32_t(bytecode.size());
+                        bytecode.push_back({LOOP_END, int(start), source_offset()});
+                    }
+                    break;
+                }
             }
-            case ',': {
-                while (i + 1 < program_size && program[i + 1] == ',') { ++count; ++i; }
-                bytecode.push_back({INPUT, count});
+        }
+    }
+
+    // The `[`s still open at the end have no `]` to jump to
+    std::vector<Instruction> finish() {
+        flush();
+        for (size_t start : loop_stack)
+            bytecode[start] = {TRAP, '[', bytecode[start].offset};
+        loop_stack.clear();
+        return std::move(bytecode);
+    }
+
+private:
+    enum Pending { NONE, VALUE, POINTER, WRITE, READ };
+
+    void flush() {
+        switch (pending) {
+            case VALUE:
+                if (pending_count) bytecode.push_back({pending_count > 0 ? INC_VAL : DEC_VAL, std::abs(pending_count)});
                 break;
-            }
-            case '[':
-                if (i + 2 < program_size && program[i + 1] == '-' && program[i + 2] == ']') {
-                    bytecode.push_back({SET_ZERO, 1});
-                    i += 2;
-                } else {
-                    bytecode.push_back({LOOP_START, 0});
-                    loop_stack.push(bytecode.size() - 1);
-                }
+            case POINTER:
+                if (pending_count) bytecode.push_back({pending_count > 0 ? INC_PTR : DEC_PTR, std::abs(pending_count)});
                 break;
-            case ']':
-                bytecode.push_back({LOOP_END, 0});
-                if (loop_stack.empty()) {
-                    std::cerr << "Unmatched ']' at position " << i << std::endl;
-                    exit(1);
-                }
-                loop_stack.pop();
+            case WRITE: bytecode.push_back({OUTPUT, pending_count}); break;
+            case READ: bytecode.push_back({INPUT, pending_count}); break;
+            case NONE: break;
         }
+        pending = NONE;
+        pending_count = 0;
     }
-    if (!loop_stack.empty()) {
-        std::cerr << "Unmatched '[' at position " << loop_stack.top() << std::endl;
+
+    int source_offset() const { return int(std::min(position, size_t(INT32_MAX))); }
+
+    std::vector<Instruction> bytecode;
+    std::vector<size_t> loop_stack;  // indices of the LOOP_STARTs whose `]` is still to come
+    size_t position = 0;             // source position of the byte being compiled
+    Pending pending = NONE;          // run being folded, emitted once a different command arrives
+    int pending_count = 0;
+};
+
+std::vector<Instruction> compile_to_bytecode(const std::string& program) {
+    Compiler compiler;
+    compiler.feed(program.data(), program.size());
+    return compiler.finish();
+}
+
+// Compiles a program from a stream in fixed-size chunks; works for pipes whose size is unknown
+std::vector<Instruction> compile_stream(std::istream& in) {
+    Compiler compiler;
+    char chunk[1 << 16];
+    std::streamsize got;
+    while ((got = in.rdbuf()->sgetn(chunk, sizeof(chunk))) > 0)
+        compiler.feed(chunk, size_t(got));
+    return compiler.finish();
+}
+
+// Compiles the program file (or stdin for `-`)
+std::vector<Instruction> compile_file(const std::string& program_file) {
+    if (program_file == "-")
+        return compile_stream(std::cin);
+    std::ifstream file(program_file, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Cannot open file " << program_file << std::endl;
         exit(1);
     }
-    return bytecode;
+    return compile_stream(file);
 }
 
-std::vector<Instruction> optimize_bytecode(const std::vector<Instruction>& bytecode) {
-    std::vector<Instruction> optimized;
-    size_t bytecode_size = bytecode.size();
+// Reads the whole program file (or stdin for `-`); the bytecode cache needs the source to hash it
+std::string read_program(const std::string& program_file) {
+    std::ifstream file;
+    if (program_file != "-") {
+        file.open(program_file, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Cannot open file " << program_file << std::endl;
+            exit(1);
+        }
+    }
+    std::istream& in = program_file == "-" ? std::cin : file;
+    std::string source;
+    char chunk[1 << 16];
+    std::streamsize got;
+    while ((got = in.rdbuf()->sgetn(chunk, sizeof(chunk))) > 0)
+        source.append(chunk, size_t(got));
+    return source;
+}
 
-    for (size_t i = 0; i < bytecode_size; ++i) {
+// Optimization passes rewrite the bytecode in place: every pass reads instructions at `i` and
+// emits them at `write <= i`, so a pass never needs a second buffer. emit() records whether
+// the pass changed anything, which is what the pass manager iterates on, and re-links the
+// jump targets of the loops it emits, so they are valid after every pass.
+struct Rewriter {
+    std::vector<Instruction>& code;
+    size_t write = 0;
+    bool changed = false;
+    std::vector<size_t> loop_stack;  // emitted LOOP_STARTs whose LOOP_END is still to come
 
-        // Combine consecutive value modifications
-        if (bytecode[i].op == INC_VAL || bytecode[i].op == DEC_VAL) {
-            int modification = (bytecode[i].op == INC_VAL) ? bytecode[i].value : -bytecode[i].value;
-            while (i + 1 < bytecode_size && (bytecode[i + 1].op == INC_VAL || bytecode[i + 1].op == DEC_VAL)) {
-                modification += (bytecode[i + 1].op == INC_VAL ? bytecode[i + 1].value : -bytecode[i + 1].value);
-                ++i;
+    explicit Rewriter(std::vector<Instruction>& code) : code(code) {}
+
+    void emit(Instruction instr) {
+        if (instr.op == LOOP_START) {
+            loop_stack.push_back(write);
+        } else if (closes_loop(instr.op)) {
+            size_t start = loop_stack.back();
+            loop_stack.pop_back();
+            instr.value = int32_t(start);
+            if (code[start].value != int32_t(write)) {
+                code[start].value = int32_t(write);
+                changed = true;
             }
-            if (modification > 0)
-                optimized.push_back({INC_VAL, modification});
-            else if (modification < 0)
-                optimized.push_back({DEC_VAL, -modification});
-            // If modification == 0, we skip adding any instruction since it has no effect
         }
+        if (!(code[write] == instr)) {
+            code[write] = instr;
+            changed = true;
+        }
+        ++write;
+    }
+    Instruction& last() { return code[write - 1]; }
+    bool finish() {
+        if (write != code.size()) {
+            code.resize(write);
+            changed = true;
+        }
+        return changed;
+    }
+};
+
+// Emits the net effect of adding `delta` (modulo the cell width) to memory[ptr + offset], if any
+static void emit_add(Rewriter& out, uint32_t delta, int offset, uint32_t cell_mask) {
+    delta &= cell_mask;
+    if (delta != 0 && delta <= cell_mask / 2)
+        out.emit({INC_VAL, int(delta), offset});
+    else if (delta != 0)
+        out.emit({DEC_VAL, int(cell_mask - delta + 1), offset});
+}
+
+// Combine consecutive value modifications of the same cell and consecutive pointer modifications.
+// Value modifications are summed modulo the cell width (`cell_mask`), so e.g. 256 `+` vanish for 8-bit cells.
+bool merge_runs(std::vector<Instruction>& bytecode, uint32_t cell_mask) {
+    Rewriter out{bytecode};
+    size_t bytecode_size = bytecode.size();
 
-        // Combine consecutive pointer modifications
-        else if (bytecode[i].op == INC_PTR || bytecode[i].op == DEC_PTR) {
-            int modification = (bytecode[i].op == INC_PTR) ? bytecode[i].value : -bytecode[i].value;
+    for (size_t i = 0; i < bytecode_size; ++i) {
+        Instruction instr = bytecode[i];
+        if (instr.op == INC_VAL || instr.op == DEC_VAL) {
+            uint32_t modification = (instr.op == INC_VAL) ? uint32_t(instr.value) : -uint32_t(instr.value);
+            while (i + 1 < bytecode_size && (bytecode[i + 1].op == INC_VAL || bytecode[i + 1].op == DEC_VAL) &&
+                   bytecode[i + 1].offset == instr.offset) {
+                uint32_t value = uint32_t(bytecode[i + 1].value);
+                modification += (bytecode[i + 1].op == INC_VAL ? value : -value);
+                ++i;
+            }
+            emit_add(out, modification, instr.offset, cell_mask);  // nothing if the run cancels out
+        } else if (instr.op == INC_PTR || instr.op == DEC_PTR) {
+            int modification = (instr.op == INC_PTR) ? instr.value : -instr.value;
             while (i + 1 < bytecode_size && (bytecode[i + 1].op == INC_PTR || bytecode[i + 1].op == DEC_PTR)) {
                 modification += (bytecode[i + 1].op == INC_PTR ? bytecode[i + 1].value : -bytecode[i + 1].value);
                 ++i;
             }
             if (modification > 0)
-                optimized.push_back({INC_PTR, modification});
+                out.emit({INC_PTR, modification});
             else if (modification < 0)
-                optimized.push_back({DEC_PTR, -modification});
-        }
+                out.emit({DEC_PTR, -modification});
+        } else
+            out.emit(instr);
+    }
+    return out.finish();
+}
+
+// Optimize `[-]' patterns (and `[+]`, `[---]`, ...) that may have went undetected due to comments.
+// Clearing the same cell twice (e.g., `[-][-]`) is the same as clearing it once.
+bool collapse_clear_loops(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+    size_t bytecode_size = bytecode.size();
 
-        // Optimize `[-]' patterns that may have went undetected due to comments
-        else if (i + 2 < bytecode_size &&
-            bytecode[i].op == LOOP_START && bytecode[i].value == bytecode[i + 2].value &&
-            bytecode[i + 1].op == DEC_VAL && bytecode[i + 1].value == 1 &&
+    for (size_t i = 0; i < bytecode_size; ++i) {
+        Instruction instr = bytecode[i];
+        if (i + 2 < bytecode_size &&
+            instr.op == LOOP_START &&
+            is_clear_body(bytecode[i + 1]) &&
             bytecode[i + 2].op == LOOP_END) {
+            instr = {SET_ZERO, 1};
+            i += 2;
+        }
+        if (instr.op == SET_ZERO && out.write > 0 && out.last().op == SET_ZERO && out.last().offset == instr.offset)
+            continue;
+        out.emit(instr);
+    }
+    return out.finish();
+}
 
-            optimized.push_back({SET_ZERO, 0});
+// Optimize pointer-scan loops (e.g., `[>]`, `[<<<<<<<<<]`)
+bool collapse_scan_loops(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+    size_t bytecode_size = bytecode.size();
+
+    for (size_t i = 0; i < bytecode_size; ++i) {
+        Instruction instr = bytecode[i];
+        if (i + 2 < bytecode_size &&
+            instr.op == LOOP_START &&
+            (bytecode[i + 1].op == INC_PTR || bytecode[i + 1].op == DEC_PTR) &&
+            bytecode[i + 2].op == LOOP_END) {
+            instr = {SCAN, bytecode[i + 1].op == INC_PTR ? bytecode[i + 1].value : -bytecode[i + 1].value};
             i += 2;
         }
+        out.emit(instr);
+    }
+    return out.finish();
+}
 
-        // Optimize loops that clear a range of cells (e.g., `[-]>[-]>[-]`)
-        else if (i + 1 < bytecode_size && bytecode[i].op == SET_ZERO) {
-            int clear_count = 1;
-            while (i + 1 < bytecode_size && bytecode[i + 1].op == SET_ZERO) { ++clear_count; ++i; }
-            if (clear_count > 1)
-                optimized.push_back({CLEAR_RANGE, clear_count});
-            else
-                optimized.push_back(bytecode[i]);
+// Inverse of an odd `x` modulo 2^32 (Newton's iteration doubles the correct low bits every step)
+static uint32_t odd_inverse(uint32_t x) {
+    uint32_t inverse = x;  // correct to 3 bits for any odd x
+    for (int k = 0; k < 4; ++k)
+        inverse *= 2 - x * inverse;
+    return inverse;
+}
+
+// Replaces balanced, I/O-free loops whose counter cell changes by a fixed step per iteration
+// (e.g. `[->>+<<]`, `[-<+>>+<]`, `[--->+<]`) by one MUL_ADD per touched cell and a SET_ZERO.
+// With counter c and step d the loop runs n times, the smallest n with c + n * d == 0 modulo the
+// cell width 2^w, and each cell ends up with += n * (its per-iteration delta):
+// - d odd: n = c * -d^-1, so a cell with delta k gets MUL_ADD k * -d^-1. `[-]` is d = -1.
+// - d = 2^s * odd: the loop only ends if c is a multiple of 2^s, and then n = c / 2^s * -odd^-1.
+//   The product is linear in c only if every k is a multiple of 2^s: such a loop becomes the
+//   MUL_ADDs (k / 2^s) * -odd^-1, then c *= 2^(w-s), which is zero exactly when the loop ends,
+//   and an empty loop `[]`, which keeps the original's endless spin for any other c. The MUL_ADDs
+//   need c, so they come before the spin: a watchdog stop or checkpoint inside it sees the other
+//   cells already updated, a tape state the source loop never reaches.
+// A loop that does not change its counter (d = 0) never ends once entered and is left alone.
+bool fold_multiply_loops(std::vector<Instruction>& bytecode, uint32_t cell_mask) {
+    Rewriter out{bytecode};
+    size_t bytecode_size = bytecode.size();
+
+    for (size_t i = 0; i < bytecode_size; ++i) {
+        if (bytecode[i].op == LOOP_START) {
+            std::vector<std::pair<int, int>> deltas;  // (offset, per-iteration delta), in order of first touch
+            int offset = 0;
+            size_t j = i + 1;
+            for (; j < bytecode_size; ++j) {
+                const Instruction& instr = bytecode[j];
+                if (instr.op == INC_PTR) offset += instr.value;
+                else if (instr.op == DEC_PTR) offset -= instr.value;
+                else if (instr.op == INC_VAL || instr.op == DEC_VAL) {
+                    int delta = (instr.op == INC_VAL) ? instr.value : -instr.value;
+                    int cell = offset + instr.offset;
+                    auto it = deltas.begin();
+                    while (it != deltas.end() && it->first != cell) ++it;
+                    if (it == deltas.end())
+                        deltas.push_back({cell, delta});
+                    else
+                        it->second += delta;
+                } else
+                    break;
+            }
+
+            bool is_multiply_loop = j < bytecode_size && bytecode[j].op == LOOP_END && offset == 0;
+            int counter_delta = 0;
+            for (const auto& [cell, delta] : deltas)
+                if (cell == 0) counter_delta += delta;
+            uint32_t step = uint32_t(counter_delta) & cell_mask;
+            int shift = step ? std::countr_zero(step) : 0;
+            uint32_t per_count = -odd_inverse(step >> shift);  // iterations per unit of c / 2^s
+            bool linear = step != 0;
+            for (const auto& [cell, delta] : deltas)
+                if (cell != 0 && (uint32_t(delta) & cell_mask & ((1u << shift) - 1)) != 0)
+                    linear = false;
+            if (is_multiply_loop && linear) {
+                // Every loop instruction has been read, so emitting over them is safe once the
+                // source positions of the brackets are saved
+                int open_position = bytecode[i].offset;
+                int close_position = bytecode[j].offset;
+                for (const auto& [cell, delta] : deltas) {
+                    uint32_t factor = ((uint32_t(delta) & cell_mask) >> shift) * per_count & cell_mask;
+                    if (cell != 0 && factor != 0)
+                        out.emit({MUL_ADD, int(factor), cell});
+                }
+                if (shift == 0) {
+                    out.emit({SET_ZERO, 1});
+                } else {
+                    out.emit({MUL_ADD, int(cell_mask >> shift), 0, 0});
+                    out.emit({LOOP_START, 0, open_position});
+                    out.emit({LOOP_END, 0, close_position});
+                }
+                i = j;
+                continue;
+            }
         }
+        out.emit(bytecode[i]);
+    }
+    return out.finish();
+}
 
-        else
-            optimized.push_back(bytecode[i]); // Default case: push the current instruction
+// Folds pointer movements within each straight-line run between LOOP_START/LOOP_END into the
+// offsets of the instructions that follow them, and emits the run's net pointer movement once,
+// right before the loop boundary (or the end of the program) where memory[ptr] is tested.
+bool fold_offsets(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+    int shift = 0;  // pointer movement not yet materialized
+
+    // Emits at most one instruction per run of consumed pointer movements, so write <= i still holds
+    auto flush_shift = [&]() {
+        if (shift > 0)
+            out.emit({INC_PTR, shift});
+        else if (shift < 0)
+            out.emit({DEC_PTR, -shift});
+        shift = 0;
+    };
+
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        Instruction instr = bytecode[i];
+        switch (instr.op) {
+            case INC_PTR: shift += instr.value; break;
+            case DEC_PTR: shift -= instr.value; break;
+            case LOOP_START:
+            case LOOP_END:
+            case SCAN:
+            case TRAP:
+                flush_shift();
+                out.emit(instr);
+                break;
+            default:
+                if (instr.op == MUL_ADD && !fits_source(instr.source + shift))
+                    flush_shift();
+                instr.offset += shift;
+                if (instr.op == MUL_ADD)
+                    instr.source += shift;
+                out.emit(instr);
+                break;
+        }
+    }
+    flush_shift();
+    return out.finish();
+}
+
+// Merges adjacent SET_ZEROs and CLEAR_RANGEs that cover neighbouring cells (e.g., `[-]>[-]>[-]`
+// after offset folding) into one CLEAR_RANGE
+bool merge_clears(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        Instruction instr = bytecode[i];
+        if ((instr.op == SET_ZERO || instr.op == CLEAR_RANGE) && out.write > 0 &&
+            (out.last().op == SET_ZERO || out.last().op == CLEAR_RANGE)) {
+            Instruction& last = out.last();
+            int count = (instr.op == SET_ZERO) ? 1 : instr.value;
+            int last_count = (last.op == SET_ZERO) ? 1 : last.value;
+            if (instr.offset == last.offset + last_count || instr.offset + count == last.offset) {
+                last = {CLEAR_RANGE, last_count + count, std::min(instr.offset, last.offset)};
+                out.changed = true;
+                continue;
+            }
+        }
+        out.emit(instr);
     }
-    return optimized;
+    return out.finish();
 }
 
+// Cell contents known at one point of the program, keyed by cell position relative to the pointer
+// at the start of the analysed code. `fresh` means every cell not in `cells` still holds its
+// initial zero, which is true until the first loop that moves the pointer by an unknown amount.
+// Cells left of cell 0 are off the tape and hold nothing: an access to them has to stay and fault.
+struct KnownCells {
+    std::unordered_map<int, std::optional<uint32_t>> cells;  // nullopt = unknown
+    bool fresh = true;
 
-void interpret_bytecode(const std::vector<Instruction>& bytecode) {
-    std::vector<unsigned char> memory(30000, 0); // "Brainfuck uses 30,000 cells"
-    size_t ptr = 0;
-    std::vector<size_t> loop_starts(bytecode.size(), 0); // Precomputed loop jumps
-    std::stack<size_t> loop_stack;
+    std::optional<uint32_t> get(int cell) const {
+        auto it = cells.find(cell);
+        if (it != cells.end())
+            return it->second;
+        return fresh && cell >= 0 ? std::optional<uint32_t>(0) : std::nullopt;
+    }
+    void set(int cell, std::optional<uint32_t> value) {
+        if (value || fresh)
+            cells[cell] = value;
+        else
+            cells.erase(cell);
+    }
+    void forget() {
+        cells.clear();
+        fresh = false;
+    }
+};
 
-    // Precompute loop start/end positions for faster jumping
-    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
-        if (bytecode[pc].op == LOOP_START) {
-            loop_stack.push(pc);
-        } else if (bytecode[pc].op == LOOP_END) {
-            size_t start = loop_stack.top();
-            loop_stack.pop();
-            loop_starts[start] = pc;
-            loop_starts[pc] = start;
+// Collects the cells (relative to ptr at the loop start) written by the loop at `start`. Returns
+// false if the loop moves the pointer on any iteration, in which case every cell may be written.
+static bool loop_writes(const std::vector<Instruction>& bytecode, size_t start, std::vector<int>& writes) {
+    std::vector<int> loop_offsets;  // pointer offset at each enclosing inner LOOP_START
+    int offset = 0;
+    for (size_t j = start + 1; j < size_t(bytecode[start].value); ++j) {
+        const Instruction& instr = bytecode[j];
+        switch (instr.op) {
+            case INC_PTR: offset += instr.value; break;
+            case DEC_PTR: offset -= instr.value; break;
+            case SCAN: return false;
+            case LOOP_START: loop_offsets.push_back(offset); break;
+            case LOOP_END:
+                if (loop_offsets.back() != offset)
+                    return false;
+                loop_offsets.pop_back();
+                break;
+            case OUTPUT: case TRAP: break;
+            case CLEAR_RANGE:
+                for (int k = 0; k < instr.value; ++k)
+                    writes.push_back(offset + instr.offset + k);
+                break;
+            case VEC_ADD:
+                for (int k = 0; k < instr.source; ++k)
+                    writes.push_back(offset + instr.offset + k);
+                break;
+            default: writes.push_back(offset + instr.offset); break;
         }
     }
+    return offset == 0;
+}
 
-    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
-        const auto& instr = bytecode[pc];
+// Forward dataflow over known cell values, starting from the all-zero tape: drops loops whose
+// counter is known to be zero when they are reached (e.g. a loop right after `]`, or at the start
+// of the program), SET_ZERO/CLEAR_RANGE of cells that are already zero, and MUL_ADDs whose factor
+// cell is known, which become constant adds (or vanish when the factor is zero). Loops that keep
+// the pointer in place only make the cells they write unknown; any other loop forgets everything.
+bool propagate_known_cells(std::vector<Instruction>& bytecode, uint32_t cell_mask) {
+    Rewriter out{bytecode};
+    KnownCells known;
+    std::vector<KnownCells> after_loop;  // state after each open loop, apart from memory[ptr] == 0
+    int ptr = 0;
+
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        Instruction instr = bytecode[i];
+        int cell = ptr + instr.offset;
         switch (instr.op) {
             case INC_PTR: ptr += instr.value; break;
             case DEC_PTR: ptr -= instr.value; break;
-            case INC_VAL: memory[ptr] += instr.value; break;
-            case DEC_VAL: memory[ptr] -= instr.value; break;
-            case OUTPUT:
-                for (int j = 0; j < instr.value; ++j)
-                    std::cout << memory[ptr];
+            case INC_VAL:
+            case DEC_VAL:
+                if (auto value = known.get(cell))
+                    known.set(cell, (*value + uint32_t(instr.op == INC_VAL ? instr.value : -instr.value)) & cell_mask);
                 break;
-            case INPUT:
-                for (int j = 0; j < instr.value; ++j)
-                    memory[ptr] = std::cin.get();
+            case INPUT: known.set(cell, std::nullopt); break;
+            case OUTPUT: break;
+            case VEC_ADD:
+                for (int k = 0; k < instr.source; ++k)
+                    if (auto value = known.get(cell + k))
+                        known.set(cell + k, (*value + uint32_t(instr.value)) & cell_mask);
                 break;
-            case SET_ZERO: memory[ptr] = 0; break;
-            case CLEAR_RANGE:
-                for (int j = 0; j < instr.value; ++j)
-                    memory[ptr + j] = 0;
-                ptr += instr.value;
+            case SET_ZERO:
+                if (known.get(cell) == 0u) {
+                    out.changed = true;
+                    continue;
+                }
+                known.set(cell, 0);
                 break;
-            case LOOP_START:
-                if (memory[ptr] == 0)
-                    pc = loop_starts[pc];
+            case CLEAR_RANGE: {
+                bool all_zero = true;
+                for (int k = 0; k < instr.value; ++k) {
+                    all_zero &= known.get(cell + k) == 0u;
+                    known.set(cell + k, 0);
+                }
+                if (all_zero) {
+                    out.changed = true;
+                    continue;
+                }
+                break;
+            }
+            case MUL_ADD: {
+                auto factor = known.get(ptr + instr.source);
+                if (!factor) {
+                    known.set(cell, std::nullopt);
+                    break;
+                }
+                uint32_t delta = uint32_t(instr.value) * *factor;
+                if (auto value = known.get(cell))
+                    known.set(cell, (*value + delta) & cell_mask);
+                emit_add(out, delta, cell - ptr, cell_mask);
+                out.changed = true;
+                continue;
+            }
+            case SCAN:
+                known.forget();
+                known.set(ptr, 0);
+                break;
+            case LOOP_START: {
+                if (known.get(ptr) == 0u) {
+                    i = size_t(instr.value);  // never entered
+                    out.changed = true;
+                    continue;
+                }
+                std::vector<int> writes;
+                if (loop_writes(bytecode, i, writes)) {
+                    for (int write : writes)
+                        known.set(ptr + write, std::nullopt);
+                } else
+                    known.forget();
+                after_loop.push_back(known);
                 break;
+            }
             case LOOP_END:
-                if (memory[ptr] != 0)
-                    pc = loop_starts[pc] - 1; // -1 to adjust for the upcoming increment
+                // A loop that moves the pointer leaves `ptr` out of step with the cells, but then
+                // all that is known is the exit condition at the current position
+                known = std::move(after_loop.back());
+                after_loop.pop_back();
+                known.set(ptr, 0);
                 break;
+            case TRAP:
+                if (instr.value != '[')
+                    known.set(ptr, 0);  // execution only gets past it on a zero cell
+                break;
+            case MUL_CLEAR: case SHIFT_LOOP_END: case CHECK:
+                break;  // split by PassManager::run before any pass, or inserted after them
         }
+        out.emit(instr);
     }
+    return out.finish();
 }
 
-// Reads program file (or stdin if piped) into a string
-std::string read_program(const std::string& program_file) {
-    std::ifstream file(program_file);
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open file " << program_file << std::endl;
-        exit(1);
+// Runs I/O-free bytecode at compile time on a scratch tape of `cell_mask`-wide cells that grows up
+// to `max_cells`. run() executes code[pc..stop) and returns false if it meets an INPUT, leaves the
+// scratch tape or uses up the step budget; only failed loops and scans leave a partially updated state.
+struct PrefixEvaluator {
+    static const long max_cells = 1 << 16;
+    static const uint64_t step_budget = 1 << 22;
+
+    std::span<const Instruction> code;
+    uint32_t cell_mask;
+    std::vector<uint32_t> tape;  // cells touched so far; the ones beyond are still zero
+    int ptr = 0;
+    uint64_t steps = 0;
+    std::vector<unsigned char> output;
+
+    // A trial records the value of every cell before its first write in it, so that undoing a
+    // trial costs the cells it touched, not the whole scratch tape
+    bool in_trial = false;
+    uint32_t trial = 0;
+    std::vector<uint32_t> saved_in;                   // by cell: the last trial that saved it
+    std::vector<std::pair<uint32_t, uint32_t>> undo;  // (cell, value before the trial)
+    int trial_ptr = 0;
+    size_t trial_output = 0;
+
+    PrefixEvaluator(std::span<const Instruction> code, uint32_t cell_mask) : code(code), cell_mask(cell_mask) {}
+
+    // Makes memory[cell] addressable; false if it is outside the scratch tape
+    bool reach(long cell) {
+        if (cell < 0 || cell >= max_cells)
+            return false;
+        if (size_t(cell) >= tape.size()) {
+            tape.resize(std::min(size_t(max_cells), std::max(size_t(cell) + 1, 2 * tape.size())));
+            saved_in.resize(tape.size());
+        }
+        return true;
+    }
+
+    void set(long cell, uint32_t value) {
+        if (in_trial && saved_in[cell] != trial) {
+            saved_in[cell] = trial;
+            undo.push_back({uint32_t(cell), tape[cell]});
+        }
+        tape[cell] = value & cell_mask;
+    }
+
+    // Starts recording what run() changes, until commit() keeps it or rollback() undoes it
+    void begin_trial() {
+        in_trial = true;
+        ++trial;
+        undo.clear();
+        trial_ptr = ptr;
+        trial_output = output.size();
+    }
+    void commit() { in_trial = false; }
+    void rollback() {
+        for (auto it = undo.rbegin(); it != undo.rend(); ++it)
+            tape[it->first] = it->second;
+        ptr = trial_ptr;
+        output.resize(trial_output);
+        in_trial = false;
+    }
+
+    bool run(size_t pc, size_t stop) {
+        for (; pc < stop; ++pc) {
+            const Instruction& instr = code[pc];
+            bool moves = instr.op == INC_PTR || instr.op == DEC_PTR;
+            bool at_ptr = instr.op == LOOP_START || instr.op == LOOP_END || instr.op == SCAN || instr.op == TRAP;
+            long cell = at_ptr ? ptr : long(ptr) + instr.offset;
+            if (++steps > step_budget || (!moves && !reach(cell)))
+                return false;
+            switch (instr.op) {
+                case INC_PTR: ptr += instr.value; break;
+                case DEC_PTR: ptr -= instr.value; break;
+                case INC_VAL: set(cell, tape[cell] + uint32_t(instr.value)); break;
+                case DEC_VAL: set(cell, tape[cell] - uint32_t(instr.value)); break;
+                case OUTPUT: output.insert(output.end(), size_t(instr.value), (unsigned char)tape[cell]); break;
+                case INPUT: return false;
+                case SET_ZERO: set(cell, 0); break;
+                case CLEAR_RANGE:
+                    if (!reach(cell + instr.value - 1))
+                        return false;
+                    for (int k = 0; k < instr.value; ++k)
+                        set(cell + k, 0);
+                    break;
+                case VEC_ADD:
+                    if (!reach(cell + instr.source - 1))
+                        return false;
+                    for (int k = 0; k < instr.source; ++k)
+                        set(cell + k, tape[cell + k] + uint32_t(instr.value));
+                    break;
+                case MUL_ADD:
+                    if (!reach(long(ptr) + instr.source))
+                        return false;
+                    set(cell, tape[cell] + uint32_t(instr.value) * tape[ptr + instr.source]);
+                    break;
+                case SCAN:
+                    while (tape[ptr] != 0) {
+                        ptr += instr.value;
+                        if (!reach(ptr) || ++steps > step_budget)
+                            return false;
+                    }
+                    break;
+                case LOOP_START:
+                    if (tape[ptr] == 0)
+                        pc = size_t(instr.value);
+                    break;
+                case LOOP_END:
+                    if (tape[ptr] != 0)
+                        pc = size_t(instr.value);
+                    break;
+                case TRAP:
+                    if (trap_taken(instr.value, tape[ptr]))
+                        return false;  // left to fail at run time
+                    break;
+                case MUL_CLEAR: case SHIFT_LOOP_END: case CHECK:
+                    return false;  // split by PassManager::run before any pass, or inserted after them
+            }
+        }
+        return true;
+    }
+};
+
+// Partially evaluates the program: runs top-level instructions (whole loops at a time) at compile
+// time until one of them reads input, leaves the scratch tape or exceeds the step budget, and
+// replaces them with code that recreates the result directly: the output so far written through
+// cell 0, one constant add per non-zero cell and the final pointer movement. Programs that build
+// tables before their first `,` start from the finished tables.
+bool evaluate_prefix(std::vector<Instruction>& bytecode, uint32_t cell_mask) {
+    PrefixEvaluator eval{bytecode, cell_mask};
+    size_t stop = 0;
+    while (stop < bytecode.size()) {
+        if (bytecode[stop].op != LOOP_START && bytecode[stop].op != SCAN) {
+            if (!eval.run(stop, stop + 1))
+                break;
+            ++stop;
+            continue;
+        }
+        size_t next = bytecode[stop].op == LOOP_START ? size_t(bytecode[stop].value) + 1 : stop + 1;
+        eval.begin_trial();  // a failed loop or scan may have run halfway
+        if (!eval.run(stop, next)) {
+            eval.rollback();
+            break;
+        }
+        eval.commit();
+        stop = next;
+    }
+    if (stop == 0)
+        return false;
+
+    std::vector<Instruction> result;
+    auto add = [&](uint32_t delta, int offset) {
+        delta &= cell_mask;
+        if (delta != 0 && delta <= cell_mask / 2)
+            result.push_back({INC_VAL, int(delta), offset});
+        else if (delta != 0)
+            result.push_back({DEC_VAL, int(cell_mask - delta + 1), offset});
+    };
+    uint32_t cell0 = 0;
+    for (size_t i = 0; i < eval.output.size(); ++i) {
+        if (!result.empty() && result.back().op == OUTPUT && eval.output[i] == cell0) {
+            ++result.back().value;
+            continue;
+        }
+        add(eval.output[i] - cell0, 0);
+        result.push_back({OUTPUT, 1});
+        cell0 = eval.output[i];
     }
-    std::string program((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
-    return program;
+    eval.reach(0);
+    add(eval.tape[0] - cell0, 0);
+    for (size_t cell = 1; cell < eval.tape.size(); ++cell)
+        add(eval.tape[cell], int(cell));
+    if (eval.ptr > 0)
+        result.push_back({INC_PTR, eval.ptr});
+    else if (eval.ptr < 0)
+        result.push_back({DEC_PTR, -eval.ptr});
+
+    // The rest of the program only has complete loops, which move by the length difference
+    int32_t shift = int32_t(result.size()) - int32_t(stop);
+    for (size_t i = stop; i < bytecode.size(); ++i) {
+        result.push_back(bytecode[i]);
+        if (bytecode[i].op == LOOP_START || bytecode[i].op == LOOP_END)
+            result.back().value += shift;
+    }
+    if (result == bytecode)
+        return false;
+    bytecode = std::move(result);
+    return true;
 }
 
-// Main function to handle the CLI
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: ./brainfuck [-c] program_file\n";
-        return 1;
+// Replaces runs of at least `min_vec_cells` instructions that add the same amount to neighbouring
+// cells (`+>+>+>+` or `-<-<-<-` once the offsets are folded) by one VEC_ADD
+static const int min_vec_cells = 4;
+
+bool merge_vector_adds(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+    auto delta = [](const Instruction& instr) { return instr.op == INC_VAL ? instr.value : -instr.value; };
+    auto is_add = [](const Instruction& instr) { return instr.op == INC_VAL || instr.op == DEC_VAL; };
+
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        Instruction instr = bytecode[i];
+        if (is_add(instr) && i + 1 < bytecode.size() && is_add(bytecode[i + 1]) &&
+            delta(bytecode[i + 1]) == delta(instr) && std::abs(bytecode[i + 1].offset - instr.offset) == 1) {
+            int step = bytecode[i + 1].offset - instr.offset;
+            size_t j = i + 1;
+            while (j + 1 < bytecode.size() && j + 1 - i < size_t(INT16_MAX) && is_add(bytecode[j + 1]) &&
+                   delta(bytecode[j + 1]) == delta(instr) && bytecode[j + 1].offset == bytecode[j].offset + step)
+                ++j;
+            int count = int(j - i + 1);
+            if (count >= min_vec_cells) {
+                out.emit({VEC_ADD, delta(instr), std::min(instr.offset, bytecode[j].offset), count});
+                i = j;
+                continue;
+            }
+        }
+        out.emit(instr);
     }
+    return out.finish();
+}
 
-    bool print_bytecode = false;
-    std::string program_file;
-    if (std::string(argv[1]) == "-c") {
-        print_bytecode = true;
-        program_file = argv[2];
-    } else {
-        program_file = argv[1];
+// Fuses the adjacent pairs that dominate the dynamic pair counts of `--profile` (mandelbrot: MUL_ADD
+// then SET_ZERO 20%, a pointer move then LOOP_END 16% of all dispatches) into one super-instruction
+// each. The other passes only know the plain opcodes, so this one runs once after them.
+bool fuse_pairs(std::vector<Instruction>& bytecode, uint32_t) {
+    Rewriter out{bytecode};
+    for (size_t i = 0; i < bytecode.size(); ++i) {
+        Instruction instr = bytecode[i];
+        if (i + 1 < bytecode.size()) {
+            const Instruction& next = bytecode[i + 1];
+            if (instr.op == MUL_ADD && next.op == SET_ZERO && next.offset == instr.source) {
+                out.emit({MUL_CLEAR, instr.value, instr.offset, instr.source});
+                ++i;
+                continue;
+            }
+            int move = instr.op == INC_PTR ? instr.value : -instr.value;
+            if ((instr.op == INC_PTR || instr.op == DEC_PTR) && next.op == LOOP_END && fits_source(move)) {
+                out.emit({SHIFT_LOOP_END, next.value, next.offset, move});
+                ++i;
+                continue;
+            }
+        }
+        out.emit(instr);
     }
+    return out.finish();
+}
 
-    std::string program = read_program(program_file);
+// Undoes fuse_pairs(), so the other passes only ever see plain opcodes, also when they re-optimize
+// fused bytecode (hot loops of a loaded .bfc file in the tiered engine)
+static void split_fused(std::vector<Instruction>& bytecode) {
+    auto fused = [](const Instruction& instr) { return instr.op == MUL_CLEAR || instr.op == SHIFT_LOOP_END; };
+    size_t count = size_t(std::count_if(bytecode.begin(), bytecode.end(), fused));
+    if (count == 0)
+        return;
+    std::vector<Instruction> split;
+    split.reserve(bytecode.size() + count);
+    for (const Instruction& instr : bytecode) {
+        if (instr.op == MUL_CLEAR) {
+            split.push_back({MUL_ADD, instr.value, instr.offset, instr.source});
+            split.push_back({SET_ZERO, 0, instr.source});
+        } else if (instr.op == SHIFT_LOOP_END) {
+            split.push_back({instr.source > 0 ? INC_PTR : DEC_PTR, std::abs(int(instr.source))});
+            split.push_back({LOOP_END, 0, instr.offset});
+        } else {
+            split.push_back(instr);
+        }
+    }
+    bytecode.swap(split);
+    Rewriter relink{bytecode};
+    for (const Instruction& instr : bytecode)
+        relink.emit(instr);
+}
 
-    std::vector<Instruction> bytecode = compile_to_bytecode(program);
-    for (int i = 0; i < 7; ++i)
-        bytecode = optimize_bytecode(bytecode);
+// Whether the loop at `start` provably never ends once it is entered: its body has no inner loop or
+// scan, returns the pointer to where it started and never writes memory[ptr], so the counter stays
+// nonzero forever. Covers `[]`, `[+-]`, `[>+<]`, `[.]` and the `[]` that the mul pass emits after a
+// loop with an even counter step. Works on final bytecode, fused instructions included.
+static bool is_endless_loop(std::span<const Instruction> code, size_t start) {
+    int offset = 0;  // pointer movement since the loop start
+    for (size_t j = start + 1; j <= size_t(code[start].value); ++j) {
+        const Instruction& instr = code[j];
+        int cell = offset + instr.offset;
+        switch (instr.op) {
+            case INC_PTR: offset += instr.value; break;
+            case DEC_PTR: offset -= instr.value; break;
+            case OUTPUT: break;
+            case LOOP_END: return offset == 0;
+            case SHIFT_LOOP_END: return offset + instr.source == 0;
+            case LOOP_START: case SCAN: case TRAP: return false;
+            case CLEAR_RANGE:
+                if (cell <= 0 && cell + instr.value > 0)
+                    return false;
+                break;
+            case VEC_ADD:
+                if (cell <= 0 && cell + instr.source > 0)
+                    return false;
+                break;
+            case MUL_CLEAR:
+                if (cell == 0 || offset + instr.source == 0)
+                    return false;
+                break;
+            default:  // INC_VAL, DEC_VAL, INPUT, SET_ZERO, MUL_ADD
+                if (cell == 0)
+                    return false;
+                break;
+        }
+    }
+    return false;
+}
 
-    if (print_bytecode) { // Output the bytecode instead of executing
-        for (const Instruction& instr : bytecode) {
-            switch (instr.op) {
-                case INC_PTR: std::cout << "INC_PTR " << instr.value << " "; break;
-                case DEC_VAL: std::cout << "DEC_VAL " << instr.value << " "; break;
-                case INC_VAL: std::cout << "INC_VAL " << instr.value << " "; break;
-                case DEC_PTR: std::cout << "DEC_PTR " << instr.value << " "; break;
-                case OUTPUT: std::cout << "OUTPUT " << instr.value << " "; break;
-                case INPUT: std::cout << "INPUT " << instr.value << " "; break;
-                case SET_ZERO: std::cout << "SET_ZERO "; break;
-                case CLEAR_RANGE: std::cout << "CLEAR_RANGE "; break;
-                case LOOP_START: std::cout << "LOOP_START "; break;
-                case LOOP_END: std::cout << "LOOP_END "; break;
-                default: std::cout << "UNKNOWN "; break;
+// Puts a TRAP 'L' at the start of the body of every endless loop, so a run with a Watchdog stops as
+// soon as it enters one instead of when its budget runs out. Not a pass: it turns a hang into an
+// error. Returns the source positions of the `[` of the trapped loops.
+std::vector<int> trap_endless_loops(std::vector<Instruction>& bytecode) {
+    std::vector<int> positions;
+    std::vector<Instruction> trapped;
+    trapped.reserve(bytecode.size());
+    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
+        trapped.push_back(bytecode[pc]);
+        if (bytecode[pc].op == LOOP_START && is_endless_loop(bytecode, pc)) {
+            positions.push_back(bytecode[pc].offset);
+            trapped.push_back({TRAP, 'L', bytecode[pc].offset});
+        }
+    }
+    if (positions.empty())
+        return positions;
+    bytecode.swap(trapped);
+    Rewriter relink{bytecode};
+    for (const Instruction& instr : bytecode)
+        relink.emit(instr);
+    return positions;
+}
+
+// The cells a piece of code accesses, relative to ptr where it starts
+struct CellWindow {
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+
+    bool empty() const { return lo > hi; }
+    void add(int64_t from, int64_t to) {
+        lo = std::min(lo, from);
+        hi = std::max(hi, to);
+    }
+
+    // Adds the cells `instr` accesses when ptr is at `pos`; SHIFT_LOOP_END after its move
+    void add(const Instruction& instr, int64_t pos) {
+        int64_t cell = pos + instr.offset;
+        switch (instr.op) {
+            case INC_PTR: case DEC_PTR: case CHECK: break;
+            case LOOP_START: case LOOP_END: case SHIFT_LOOP_END: case TRAP: case SCAN: add(pos, pos); break;
+            case MUL_ADD: case MUL_CLEAR: add(cell, cell); add(pos + instr.source, pos + instr.source); break;
+            case CLEAR_RANGE: if (instr.value > 0) add(cell, cell + instr.value - 1); break;
+            case VEC_ADD: add(cell, cell + instr.source - 1); break;
+            default: add(cell, cell); break;  // INC_VAL, DEC_VAL, OUTPUT, INPUT, SET_ZERO
+        }
+    }
+};
+
+// Range checks for runs that must not rely on the guard pages (`--checked`, ProgramOptions::checked).
+// A CHECK starts a region of code that is only ever entered at its start: the program, the body of a
+// loop whose pointer movement is not known, and the code after such a loop or a SCAN. Its window
+// covers every cell the region can access, relative to ptr at the CHECK, so the accesses themselves
+// stay unchecked. A loop is balanced if it returns the pointer to where it started and contains no
+// SCAN and only balanced loops: every iteration accesses the same cells, so it needs no check of its
+// own and adds its cells to the region around it. Only the bodies of unbalanced loops are checked
+// once per iteration. A window may include cells of a loop that does not run; a CHECK that fails
+// therefore does not stop the run but makes the engine continue with run_careful(), which checks
+// every access and reports the first one that is actually off the tape, as a guard fault would.
+void insert_range_checks(std::vector<Instruction>& bytecode) {
+    // Windows of the balanced loops, relative to ptr at their LOOP_START, in one pass from the inside out
+    struct Frame {
+        size_t start = 0;
+        int64_t pos = 0;
+        CellWindow window;
+        bool balanced = true;
+    };
+    std::vector<std::optional<CellWindow>> balanced(bytecode.size());
+    std::vector<Frame> frames(1);
+    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
+        const Instruction& instr = bytecode[pc];
+        Frame& frame = frames.back();
+        if (instr.op == INC_PTR || instr.op == DEC_PTR)
+            frame.pos += instr.op == INC_PTR ? instr.value : -int64_t(instr.value);
+        else if (instr.op == SHIFT_LOOP_END)
+            frame.pos += instr.source;
+        frame.window.add(instr, frame.pos);
+        if (instr.op == SCAN)
+            frame.balanced = false;
+        if (instr.op == LOOP_START) {
+            frames.emplace_back();
+            frames.back().start = pc;
+            frames.back().window.add(0, 0);
+        } else if (closes_loop(instr.op)) {
+            Frame loop = frames.back();
+            frames.pop_back();
+            Frame& outer = frames.back();
+            if (loop.balanced && loop.pos == 0) {
+                balanced[loop.start] = loop.window;
+                outer.window.add(outer.pos + loop.window.lo, outer.pos + loop.window.hi);
+            } else {
+                outer.balanced = false;
+            }
+        }
+    }
+
+    std::vector<Instruction> checked;
+    checked.reserve(bytecode.size() + bytecode.size() / 4);
+    size_t check = 0;  // index of the CHECK of the current region
+    int64_t pos = 0;
+    CellWindow window;
+    auto open = [&] {
+        check = checked.size();
+        checked.push_back({CHECK, 0});
+        pos = 0;
+        window = CellWindow();
+    };
+    auto close = [&] {
+        auto clamp = [](int64_t offset) { return int32_t(std::clamp<int64_t>(offset, INT32_MIN, INT32_MAX)); };
+        checked[check].offset = window.empty() ? 1 : clamp(window.lo);  // lo > hi: dropped below
+        checked[check].value = window.empty() ? 0 : clamp(window.hi);
+    };
+    open();
+    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
+        const Instruction& instr = bytecode[pc];
+        if (instr.op == LOOP_START && balanced[pc]) {
+            window.add(pos + balanced[pc]->lo, pos + balanced[pc]->hi);
+            size_t end = size_t(instr.value);
+            checked.insert(checked.end(), bytecode.begin() + std::ptrdiff_t(pc), bytecode.begin() + std::ptrdiff_t(end) + 1);
+            pc = end;
+            continue;
+        }
+        if (instr.op == INC_PTR || instr.op == DEC_PTR)
+            pos += instr.op == INC_PTR ? instr.value : -int64_t(instr.value);
+        else if (instr.op == SHIFT_LOOP_END)
+            pos += instr.source;
+        window.add(instr, pos);
+        checked.push_back(instr);
+        if (instr.op == LOOP_START || closes_loop(instr.op) || instr.op == SCAN) {
+            close();
+            open();
+        }
+    }
+    close();
+
+    std::erase_if(checked, [](const Instruction& instr) { return instr.op == CHECK && instr.offset > instr.value; });
+    bytecode.swap(checked);
+    Rewriter relink{bytecode};
+    for (const Instruction& instr : bytecode)
+        relink.emit(instr);
+}
+
+struct Pass {
+    const char* name;
+    int level;  // lowest -O level that enables the pass
+    bool (*run)(std::vector<Instruction>&, uint32_t cell_mask);
+    bool final = false;  // runs once after the others have reached their fixed point
+};
+
+// Run in this order on every iteration of the pass manager
+static const Pass passes[] = {
+    {"merge", 1, merge_runs},
+    {"clear", 1, collapse_clear_loops},
+    {"scan", 1, collapse_scan_loops},
+    {"mul", 2, fold_multiply_loops},
+    {"offset", 2, fold_offsets},
+    {"range-clear", 2, merge_clears},
+    {"vec-add", 2, merge_vector_adds},
+    {"known", 2, propagate_known_cells},
+    {"prefix", 3, evaluate_prefix},
+    {"fuse", 2, fuse_pairs, true},
+};
+static const size_t pass_count = sizeof(passes) / sizeof(passes[0]);
+
+// Runs the enabled passes in order until none of them changes the bytecode any more, then the final ones
+class PassManager {
+public:
+    // Value arithmetic in the passes wraps at `cell_bits` like the cells of the engine that runs the result
+    explicit PassManager(int level, int cell_bits = 8) : cell_mask(uint32_t(~0ull >> (64 - cell_bits))) {
+        for (size_t p = 0; p < pass_count; ++p)
+            enabled[p] = passes[p].level <= level;
+    }
+
+    // Enables `name`, or disables it when written as `-name`; returns false for unknown passes
+    bool set_pass(std::string name) {
+        bool enable = true;
+        if (!name.empty() && name[0] == '-') {
+            enable = false;
+            name.erase(0, 1);
+        }
+        for (size_t p = 0; p < pass_count; ++p) {
+            if (name == passes[p].name) {
+                enabled[p] = enable;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::vector<Instruction>& bytecode) {
+        split_fused(bytecode);
+        bool changed = true;
+        for (iterations = 0; changed && iterations < max_iterations; ++iterations) {
+            changed = false;
+            for (size_t p = 0; p < pass_count; ++p)
+                if (enabled[p] && !passes[p].final)
+                    changed |= run_pass(p, bytecode);
+        }
+        for (size_t p = 0; p < pass_count; ++p)
+            if (enabled[p] && passes[p].final)
+                run_pass(p, bytecode);
+    }
+
+    // Bit p is set when passes[p] is enabled, the cell mask is in the upper half; identifies the
+    // optimizer settings in the bytecode cache
+    uint64_t signature() const {
+        uint64_t bits = uint64_t(cell_mask) << 32;
+        for (size_t p = 0; p < pass_count; ++p)
+            bits |= uint64_t(enabled[p]) << p;
+        return bits;
+    }
+
+    void print_report(std::ostream& os) const {
+        os << "pass           runs  changed  removed    time (us)\n";
+        for (size_t p = 0; p < pass_count; ++p) {
+            if (!enabled[p])
+                continue;
+            char line[96];
+            snprintf(line, sizeof(line), "%-12s %6d %8d %8ld %12.1f\n", passes[p].name, stats[p].runs,
+                     stats[p].changes, stats[p].removed, stats[p].seconds * 1e6);
+            os << line;
+        }
+        os << iterations << " iteration(s)\n";
+    }
+
+private:
+    static const int max_iterations = 16;  // safety net; real programs settle after 2-3 iterations
+
+    bool run_pass(size_t p, std::vector<Instruction>& bytecode) {
+        size_t before = bytecode.size();
+        auto start = std::chrono::steady_clock::now();
+        bool changed = passes[p].run(bytecode, cell_mask);
+        stats[p].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats[p].runs += 1;
+        stats[p].changes += changed;
+        stats[p].removed += long(before) - long(bytecode.size());
+        return changed;
+    }
+
+    struct PassStats {
+        int runs = 0;
+        int changes = 0;
+        long removed = 0;   // instruction-count delta (positive = shrunk)
+        double seconds = 0;
+    };
+
+    uint32_t cell_mask;
+    bool enabled[pass_count];
+    PassStats stats[pass_count];
+    int iterations = 0;
+};
+
+static bool valid_cell_bits(int bits) {
+    return bits == 8 || bits == 16 || bits == 32;
+}
+
+// Precompiled bytecode files (`--emit=`, `--cache=`) are a header followed by the raw Instruction
+// array, so loading one is an mmap plus a linear validity check: no parsing and no passes.
+struct BytecodeHeader {
+    char magic[4];        // "BFC" and the format version
+    uint32_t instr_size;  // sizeof(Instruction) of the writer, rejects files from other layouts
+    uint64_t count;       // number of instructions
+    uint64_t key;         // bytecode_key() of the source for cache entries, 0 for --emit
+    uint32_t cell_bits;   // cell width the passes optimized for, which the program then runs with
+    uint32_t reserved;
+};
+static const char bytecode_magic[4] = {'B', 'F', 'C', 2};
+
+// Mixes data[0..size) into a 64-bit FNV-1a hash
+static void fnv1a(uint64_t& hash, const void* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<const unsigned char*>(data)[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+// 64-bit FNV-1a over the source, the pass selection and the format, naming a cache entry
+uint64_t bytecode_key(const std::string& source, uint64_t pass_signature) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const void* data, size_t size) { fnv1a(hash, data, size); };
+    uint32_t instr_size = sizeof(Instruction);
+    mix(bytecode_magic, sizeof(bytecode_magic));
+    mix(&instr_size, sizeof(instr_size));
+    mix(&pass_signature, sizeof(pass_signature));
+    mix(source.data(), source.size());
+    return hash ? hash : 1;  // 0 marks files without a key
+}
+
+// 64-bit FNV-1a over the instructions and the cell width a program runs with, naming the program
+// a checkpoint belongs to. Hashes the fields one by one: Instruction has a padding byte.
+uint64_t bytecode_hash(std::span<const Instruction> code, int cell_bits) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    fnv1a(hash, &cell_bits, sizeof(cell_bits));
+    for (const Instruction& instr : code) {
+        fnv1a(hash, &instr.op, sizeof(instr.op));
+        fnv1a(hash, &instr.source, sizeof(instr.source));
+        fnv1a(hash, &instr.value, sizeof(instr.value));
+        fnv1a(hash, &instr.offset, sizeof(instr.offset));
+    }
+    return hash;
+}
+
+// The engines trust opcodes, counts and loop links, so a loaded file is checked once up front
+bool verify_bytecode(std::span<const Instruction> code) {
+    std::vector<size_t> loop_stack;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        const Instruction& instr = code[pc];
+        if (instr.op >= bytecode_count)
+            return false;
+        switch (instr.op) {
+            case OUTPUT: case INPUT: case CLEAR_RANGE:
+                if (instr.value < 0)
+                    return false;
+                break;
+            case SCAN:
+                if (instr.value == 0)
+                    return false;
+                break;
+            case VEC_ADD:
+                if (instr.source <= 0)
+                    return false;
+                break;
+            case TRAP:
+                if (instr.value != '[' && instr.value != ']')
+                    return false;
+                break;
+            case CHECK:  // inserted for a run, like TRAP 'L'
+                return false;
+            case LOOP_START:
+                loop_stack.push_back(pc);
+                break;
+            case LOOP_END: case SHIFT_LOOP_END:
+                if (loop_stack.empty() || size_t(instr.value) != loop_stack.back() ||
+                    size_t(code[loop_stack.back()].value) != pc)
+                    return false;
+                loop_stack.pop_back();
+                break;
+            default:
+                break;
+        }
+    }
+    return loop_stack.empty();
+}
+
+// Writes to a temporary file and renames it, so concurrent runs never map a partial cache entry
+bool write_bytecode(const std::string& path, std::span<const Instruction> code, uint64_t key, int cell_bits) {
+    BytecodeHeader header = {};
+    std::memcpy(header.magic, bytecode_magic, sizeof(header.magic));
+    header.instr_size = sizeof(Instruction);
+    header.count = code.size();
+    header.key = key;
+    header.cell_bits = uint32_t(cell_bits);
+
+    std::string temp = path + ".tmp" + std::to_string(getpid());
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(code.data()), std::streamsize(code.size_bytes()));
+    file.close();
+    if (!file || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+enum LoadResult {
+    LOAD_OK,
+    LOAD_NOT_BYTECODE,  // missing, not a regular file, or no magic: treat as Brainfuck source
+    LOAD_INVALID,       // has the magic but is truncated, from another layout, or fails verify_bytecode
+};
+
+// A read-only mapping of a bytecode file; the instructions are used in place
+class MappedBytecode {
+public:
+    MappedBytecode() = default;
+    MappedBytecode(const MappedBytecode&) = delete;
+    MappedBytecode& operator=(const MappedBytecode&) = delete;
+    ~MappedBytecode() { unmap(); }
+
+    LoadResult map(const std::string& path) {
+        unmap();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return LOAD_NOT_BYTECODE;
+        struct stat st;
+        BytecodeHeader header;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || size_t(st.st_size) < sizeof(header) ||
+            pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+            std::memcmp(header.magic, bytecode_magic, sizeof(header.magic)) != 0) {
+            close(fd);
+            return LOAD_NOT_BYTECODE;
+        }
+        if (header.instr_size != sizeof(Instruction) || !valid_cell_bits(int(header.cell_bits)) ||
+            header.count != (size_t(st.st_size) - sizeof(header)) / sizeof(Instruction) ||
+            (size_t(st.st_size) - sizeof(header)) % sizeof(Instruction) != 0) {
+            close(fd);
+            return LOAD_INVALID;
+        }
+        void* mem = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+            return LOAD_INVALID;
+        base = mem;
+        length = size_t(st.st_size);
+        if (!verify_bytecode(code())) {
+            unmap();
+            return LOAD_INVALID;
+        }
+        return LOAD_OK;
+    }
+
+    const BytecodeHeader& header() const { return *static_cast<const BytecodeHeader*>(base); }
+
+    std::span<const Instruction> code() const {
+        auto first = reinterpret_cast<const Instruction*>(static_cast<const char*>(base) + sizeof(BytecodeHeader));
+        return {first, size_t(header().count)};
+    }
+
+private:
+    void unmap() {
+        if (base)
+            munmap(base, length);
+        base = nullptr;
+    }
+
+    void* base = nullptr;
+    size_t length = 0;
+};
+
+// What INPUT stores when the input is exhausted (`--eof=`)
+enum EofMode {
+    EOF_UNCHANGED,  // leave the cell as it is
+    EOF_ZERO,       // store 0
+    EOF_MAX,        // store all ones: 255 for 8-bit cells, i.e. (unsigned char)EOF as returned by getchar()
+};
+
+// Writes all of data[0..size) to fd, retrying short writes; false if the descriptor fails (e.g. a
+// closed pipe)
+static bool write_all(int fd, const void* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::write(fd, static_cast<const char*>(data) + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += size_t(n);
+    }
+    return true;
+}
+
+// Callbacks for programs that do not talk to file descriptors (`--batch` jobs collected in memory,
+// the VM library API): a sink receives every flushed chunk of output, a source fills up to `size`
+// bytes of input and returns how many it wrote, 0 at the end of the input.
+using OutputSink = std::function<void(const unsigned char* data, size_t size)>;
+using InputSource = std::function<size_t(unsigned char* data, size_t size)>;
+
+// User-space output buffer written with write(2) or handed to an OutputSink. OUTPUT n becomes a
+// single memset into the buffer; the buffer is flushed when full, at the end of execution, before
+// the program blocks on input, and after every newline when the output is a terminal.
+class Output {
+public:
+    explicit Output(int fd) : fd(fd), line_buffered(isatty(fd)) {}
+    explicit Output(OutputSink sink) : fd(-1), line_buffered(false), sink(std::move(sink)) {}
+    ~Output() { flush(); }
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    BF_NOINLINE void put(unsigned char c, int count) {
+        while (count > 0) {
+            size_t n = std::min(size_t(count), sizeof(buffer) - length);
+            std::memset(buffer + length, c, n);
+            length += n;
+            count -= int(n);
+            if (length == sizeof(buffer))
+                flush();
+        }
+        if (line_buffered && c == '\n')
+            flush();
+    }
+
+    void flush() {
+        if (sink)
+            sink(buffer, length);
+        else
+            write_all(fd, buffer, length);  // on failure drop the output, like a failed std::cout
+        written += length;
+        length = 0;
+    }
+
+    // Bytes flushed so far
+    uint64_t bytes_written() const { return written; }
+
+private:
+    int fd;
+    uint64_t written = 0;
+    bool line_buffered;
+    OutputSink sink;
+    size_t length = 0;
+    unsigned char buffer[1 << 16];
+};
+
+// Read-ahead input buffer over read(2) or an InputSource
+class Input {
+public:
+    Input(int fd, EofMode eof_mode, Output& output) : fd(fd), eof_mode(eof_mode), output(output) {}
+    Input(InputSource source, EofMode eof_mode, Output& output)
+        : fd(-1), eof_mode(eof_mode), output(output), source(std::move(source)) {}
+    Input(const Input&) = delete;
+    Input& operator=(const Input&) = delete;
+
+    // INPUT n: reads n bytes into the cell, so only the last one remains visible
+    template <class Cell>
+    BF_NOINLINE void get(Cell* cell, int count) {
+        for (int j = 0; j < count; ++j) {
+            if (position == length && !refill()) {
+                if (eof_mode == EOF_ZERO) *cell = 0;
+                else if (eof_mode == EOF_MAX) *cell = Cell(-1);
+                else (void)*static_cast<volatile Cell*>(cell);  // still an access, which faults off the tape
+                continue;
+            }
+            *cell = buffer[position++];
+        }
+    }
+
+    // Bytes the program has read so far, not counting the read-ahead
+    uint64_t bytes_read() const { return total - (length - position); }
+
+private:
+    bool refill() {
+        if (at_eof)
+            return false;
+        output.flush();  // make prompts visible before blocking
+        ssize_t n;
+        if (source) {
+            n = ssize_t(source(buffer, sizeof(buffer)));
+        } else {
+            do {
+                n = ::read(fd, buffer, sizeof(buffer));
+            } while (n < 0 && errno == EINTR);
+        }
+        if (n <= 0) {
+            at_eof = true;
+            return false;
+        }
+        position = 0;
+        length = size_t(n);
+        total += uint64_t(n);
+        return true;
+    }
+
+    int fd;
+    EofMode eof_mode;
+    Output& output;
+    InputSource source;
+    bool at_eof = false;
+    size_t position = 0, length = 0;
+    uint64_t total = 0;  // bytes refilled so far
+    unsigned char buffer[1 << 16];
+};
+
+// Checkpoint files (`--checkpoint=`, `--resume=`) are a header followed by `page_count` records of
+// a byte offset from cell 0 (int64_t) and `page_size` bytes of tape. Only pages the program has
+// touched and that hold anything but zeros are written, so a checkpoint is about as large as the
+// tape the program uses.
+struct CheckpointHeader {
+    char magic[4];           // "BFK" and the format version
+    uint32_t reserved;
+    uint64_t code_hash;      // bytecode_hash() of the running program
+    uint64_t pc;             // instruction to continue with
+    int64_t cell;            // current cell, as an index from cell 0
+    uint64_t input_offset;   // bytes of input the program had read
+    uint64_t output_offset;  // bytes of output it had written
+    uint64_t iterations;     // back-edges it had taken, which the watchdog limits keep counting
+    uint64_t page_size;
+    uint64_t page_count;
+};
+static const char checkpoint_magic[4] = {'B', 'F', 'K', 1};
+
+struct Checkpoint {
+    CheckpointHeader header = {};
+    std::vector<unsigned char> pages;  // the page records
+};
+
+// Limits of one run (`--max-iterations=`, `--timeout=`), enforced only where a loop jumps back. The
+// engines count taken back-edges down from a grant of fuel and ask for the next grant when it runs
+// out, which is the only time the clock is read, so a run costs one decrement per back-edge and
+// nothing per instruction. A run stops with an error once it exceeds either limit.
+// The same grants pace checkpoints of the run: every `checkpoint_every` back-edges, and at the end of
+// the grant in which a signal arrived (catch_signals()). A checkpoint is taken on a back-edge, where
+// the whole state of a run is its tape, its cell and the instruction after the jump.
+class Watchdog {
+public:
+    static const uint64_t clock_interval = 1 << 16;  // back-edges between two clock reads (~0.5 ms on mandelbrot)
+
+    uint64_t max_iterations = 0;  // taken back-edges, 0 = unlimited
+    double timeout = 0;           // wall-clock seconds from arm(), 0 = none
+
+    std::string checkpoint_path;         // file to write checkpoints to, empty = none
+    uint64_t checkpoint_every = 0;       // back-edges between two checkpoints, 0 = on a signal only
+    uint64_t code_hash = 0;              // bytecode_hash() of the program, for the checkpoints
+    const Checkpoint* resume = nullptr;  // state the engine starts the run from, if any
+
+    // Whether the run has limits. Loops that never end are only trapped then.
+    bool enabled() const { return max_iterations != 0 || timeout > 0; }
+
+    // Whether the engines have to run their WATCHED instantiations
+    bool watching() const { return enabled() || !checkpoint_path.empty() || resume; }
+
+    // Starts the clock and the back-edge count of a run, which a resumed run continues
+    void arm() {
+        used = resume ? resume->header.iterations : 0;
+        granted = 0;
+        expired = false;
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    }
+
+    // Counts the previous grant as spent and returns the next one, or 0 once a limit is exceeded: on
+    // the back-edge after the max_iterations-th, or on the first refill after the deadline
+    uint64_t fuel() {
+        used += granted;
+        if (max_iterations && used > max_iterations)
+            return 0;
+        if (timeout > 0 && std::chrono::steady_clock::now() >= deadline) {
+            expired = true;
+            return 0;
+        }
+        granted = max_iterations ? std::min(clock_interval, max_iterations + 1 - used) : clock_interval;
+        if (checkpoint_every && !checkpoint_path.empty())
+            granted = std::min(granted, checkpoint_every - used % checkpoint_every);
+        return granted;
+    }
+
+    // Whether the run was stopped by the deadline rather than by the back-edge budget
+    bool timed_out() const { return expired; }
+
+    // Back-edges taken up to the end of the current grant
+    uint64_t iterations() const { return used; }
+
+    // Whether to write a checkpoint at the back-edge that asked for fuel() last
+    bool checkpoint_due() const {
+        return !checkpoint_path.empty() && (signalled || (checkpoint_every && used % checkpoint_every == 0));
+    }
+
+    // Makes SIGUSR1 request a checkpoint, and SIGINT and SIGTERM a checkpoint and exit. A second
+    // SIGINT or SIGTERM before the checkpoint (a program blocked on input) kills the process.
+    static void catch_signals() {
+        struct sigaction action = {};
+        action.sa_handler = on_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        for (int sig : {SIGUSR1, SIGINT, SIGTERM})
+            sigaction(sig, &action, nullptr);
+    }
+
+    // The signal behind the pending checkpoint request, 0 if none; clears the request
+    static int take_signal() {
+        int sig = signalled;
+        signalled = 0;
+        return sig;
+    }
+
+private:
+    static void on_signal(int sig) {
+        if (sig != SIGUSR1 && (signalled == SIGINT || signalled == SIGTERM)) {
+            signal(sig, SIG_DFL);
+            raise(sig);
+        }
+        if (signalled != SIGINT && signalled != SIGTERM)
+            signalled = sig;
+    }
+
+    static volatile sig_atomic_t signalled;
+
+    uint64_t used = 0, granted = 0;
+    bool expired = false;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+volatile sig_atomic_t Watchdog::signalled = 0;
+
+// The I/O channels of one program execution
+struct IO {
+    Output out;
+    Input in;
+    Watchdog* watchdog = nullptr;  // limits of the execution, if any; armed by the caller
+
+    IO(int in_fd, int out_fd, EofMode eof_mode) : out(out_fd), in(in_fd, eof_mode, out) {}
+    IO(int in_fd, OutputSink out_sink, EofMode eof_mode) : out(std::move(out_sink)), in(in_fd, eof_mode, out) {}
+    IO(InputSource in_source, OutputSink out_sink, EofMode eof_mode)
+        : out(std::move(out_sink)), in(std::move(in_source), eof_mode, out) {}
+};
+
+// How far from the last cell it accessed a program can get before accessing the next one: the
+// widest run of pointer moves (or SCAN stride) between two accesses, plus the largest offset
+// on either side. Every jump target follows a loop instruction, which accesses memory[ptr].
+// Kept out of line: inlined into the engines through Tape's constructor it costs their hot loops registers.
+BF_NOINLINE static uint64_t tape_reach(std::span<const Instruction> code) {
+    uint64_t run = 0, max_run = 0, max_extent = 0;
+    for (const Instruction& instr : code) {
+        uint64_t extent = uint64_t(std::abs(int64_t(instr.offset)));
+        switch (instr.op) {
+            case INC_PTR: case DEC_PTR:
+                run += uint64_t(std::abs(int64_t(instr.value)));
+                continue;
+            case MUL_ADD: case MUL_CLEAR:
+                extent = std::max(extent, uint64_t(std::abs(int64_t(instr.source))));
+                break;
+            case SHIFT_LOOP_END:
+                run += uint64_t(std::abs(int64_t(instr.source)));
+                extent = 0;
+                break;
+            case CLEAR_RANGE:
+                extent = std::max(extent, uint64_t(std::abs(int64_t(instr.offset) + instr.value)));
+                break;
+            case VEC_ADD:
+                extent = std::max(extent, uint64_t(std::abs(int64_t(instr.offset) + instr.source)));
+                break;
+            case SCAN:
+                max_run = std::max(max_run, uint64_t(std::abs(int64_t(instr.value))));
+                break;
+            case LOOP_START: case LOOP_END: case TRAP:
+                extent = 0;  // `offset` is a source position
+                break;
+            case CHECK:
+                continue;  // accesses nothing, so a checked program gets the same tape as an unchecked one
+            default:
+                break;
+        }
+        max_run = std::max(max_run, run);
+        max_extent = std::max(max_extent, extent);
+        run = 0;
+    }
+    return std::max(max_run, run) + 2 * max_extent;
+}
+
+// How a VM run ended; also the value a run-time error jumps to the recovery point with
+enum RunResult {
+    RUN_OK,
+    RUN_OFF_TAPE,           // the program moved the pointer off the tape
+    RUN_UNMATCHED_BRACKET,  // the program took the jump of an unmatched bracket (a TRAP)
+    RUN_LIMIT_EXCEEDED,     // the run exceeded a Watchdog limit or entered a loop that never ends
+};
+
+// What ended a run with `result`, for error messages
+static const char* describe(RunResult result) {
+    switch (result) {
+        case RUN_OK: break;
+        case RUN_OFF_TAPE: return "pointer moved off the tape";
+        case RUN_UNMATCHED_BRACKET: return "took the jump of an unmatched bracket";
+        case RUN_LIMIT_EXCEEDED: return "exceeded a limit or entered a loop that never ends";
+    }
+    return "ran to the end";
+}
+
+// The tape is one large anonymous mapping that the kernel populates on first touch, so memory use
+// follows the cells a program actually uses. This is the two-level page table of a paged tape done
+// by the MMU: an access within a touched page costs nothing extra, the first one to a page takes a
+// page fault, and a program that moves the pointer millions of cells but touches few of them keeps
+// only those pages. Huge pages are turned off for the tape, so every page stays 4 KiB even where
+// transparent huge pages are on for all mappings and a single touch would otherwise cost 2 MiB. The
+// cells are surrounded by inaccessible guard regions wider than tape_reach(), so running off either
+// end faults in a guard instead of corrupting memory, and the engines use raw pointers with no
+// bounds checks. Cell 0 borders the left guard, so every access left of it is an error. A MUL_ADD
+// folded from a loop that never runs would still add 0 to its cells, which may lie off the tape, so
+// the engines skip those with a zero factor (mul_runs()). SCAN stops at cell 0 where the loop it
+// replaces would fault. Running off the tape flushes `out` and exits, unless a recovery point is
+// set (the VM API): then the fault jumps back to it and the caller reports the error.
+class Tape {
+public:
+    static const size_t default_size = sizeof(void*) == 8 ? size_t(1) << 30 : size_t(1) << 24;
+    // Bytes of cells of the tapes constructed from now on (`--tape-size=`), a multiple of the page size.
+    // Only address space: the pages a program never touches cost no memory.
+    static inline size_t size = default_size;
+
+    // `cell_size` scales the guards, which tape_reach() measures in cells. A tape for checked code
+    // (insert_range_checks) can go without the SIGSEGV handler: its engines never touch a guard.
+    Tape(std::span<const Instruction> code, Output* out, size_t cell_size = 1, bool catch_faults = true)
+        : Tape(tape_reach(code), out, cell_size, catch_faults) {}
+
+    // For engines that run code other than `code`, with a reach computed by the caller
+    Tape(uint64_t reach, Output* out, size_t cell_size = 1, bool catch_faults = true) : out(out), bytes(size) {
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        guard = size_t(reach * cell_size / page + 1) * page;
+        length = guard + bytes + guard;
+        void* mem = mmap(nullptr, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED ||
+            mprotect(static_cast<unsigned char*>(mem) + guard, bytes, PROT_READ | PROT_WRITE) != 0) {
+            std::cerr << "Error: Cannot allocate the tape" << std::endl;
+            exit(1);
+        }
+        base = static_cast<unsigned char*>(mem);
+#ifdef MADV_NOHUGEPAGE
+        madvise(begin(), bytes, MADV_NOHUGEPAGE);  // a hint: the tape works without it
+#endif
+        if (catch_faults)
+            install_fault_handler();
+        enter();
+    }
+
+    ~Tape() {
+        if (active == this)
+            leave();
+        munmap(base, length);
+    }
+
+    Tape(const Tape&) = delete;
+    Tape& operator=(const Tape&) = delete;
+
+    template <class Cell = unsigned char>
+    Cell* begin() const { return reinterpret_cast<Cell*>(base + guard); }
+    template <class Cell = unsigned char>
+    Cell* end() const { return reinterpret_cast<Cell*>(base + guard + bytes); }
+
+    // A fault is only recognized on the tape most recently entered on the faulting thread. The
+    // constructor enters the tape; a tape that outlives its first run (VM) leaves it and enters it
+    // again around every run, on whatever thread that runs.
+    void enter() {
+        previous = active;
+        active = this;
+    }
+    void leave() { active = previous; }
+
+    // Zeroes every cell by dropping their pages, which keeps the mapping
+    void clear() { madvise(begin(), bytes, MADV_DONTNEED); }
+
+    // The pages from cell 0 on that the program has touched, and the cells up to the end of the highest
+    // one. The kernel populates a page on its first access, so mincore() tells them apart for free.
+    void usage(size_t cell_size, uint64_t& pages, uint64_t& high_water) const {
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        std::vector<unsigned char> resident(bytes / page);
+        pages = high_water = 0;
+        if (mincore(begin(), bytes, resident.data()) != 0)
+            return;
+        for (size_t p = 0; p < resident.size(); ++p) {
+            if (resident[p] & 1) {
+                ++pages;
+                high_water = (p + 1) * page / cell_size;
+            }
+        }
+    }
+
+    // Calls page(offset, data, size) for every page of cells that the program has touched and that
+    // holds anything but zeros, with `offset` in bytes from cell 0
+    template <class F>
+    void for_each_page(F&& page) const {
+        size_t size = size_t(sysconf(_SC_PAGESIZE));
+        const unsigned char* first = begin();
+        std::vector<unsigned char> resident(bytes / size);
+        if (mincore(const_cast<unsigned char*>(first), bytes, resident.data()) != 0)
+            return;
+        for (size_t p = 0; p < resident.size(); ++p) {
+            const unsigned char* data = first + p * size;
+            if ((resident[p] & 1) && std::any_of(data, data + size, [](unsigned char c) { return c != 0; }))
+                page(int64_t(data - begin()), data, size);
+        }
+    }
+
+    // Width of each guard region in cells of `cell_size` bytes: code whose tape_reach() is below it
+    // can run on this tape
+    uint64_t guard_cells(size_t cell_size = 1) const { return guard / cell_size; }
+
+    // Whether the `size` bytes `offset` bytes from cell 0 lie within the cells
+    bool contains(int64_t offset, uint64_t size) const {
+        return offset >= 0 && size <= bytes && offset <= int64_t(bytes - size);
+    }
+
+    // While set, run-time errors on this tape jump to `point` instead of exiting
+    void set_recovery_point(sigjmp_buf* point) { recovery = point; }
+
+    // Jumps to the recovery point of the innermost tape of this thread with `error`, if it has one
+    static void escape(RunResult error) {
+        if (active && active->recovery)
+            siglongjmp(*active->recovery, error);
+    }
+
+private:
+    // Once per process; `--batch` workers construct their tapes concurrently
+    static void install_fault_handler() {
+        static const bool installed = [] {
+            struct sigaction action = {};
+            action.sa_sigaction = on_fault;
+            action.sa_flags = SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            return sigaction(SIGSEGV, &action, nullptr) == 0;
+        }();
+        (void)installed;
+    }
+
+    // A fault inside the mapping can only be a guard access; anything else is a real crash, which
+    // gets the default action when the faulting instruction is retried.
+    static void on_fault(int sig, siginfo_t* info, void*) {
+        auto address = static_cast<unsigned char*>(info->si_addr);
+        const Tape* tape = active;
+        if (tape && address >= tape->base && address < tape->base + tape->length) {
+            escape(RUN_OFF_TAPE);
+            if (tape->out)
+                tape->out->flush();
+            static const char message[] = "Error: pointer moved off the tape\n";
+            ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+            (void)written;
+            _exit(1);
+        }
+        signal(sig, SIG_DFL);
+    }
+
+    static thread_local const Tape* active;  // innermost tape of this thread, for on_fault
+
+    Output* out;        // flushed before exiting on a fault, may be null
+    sigjmp_buf* recovery = nullptr;
+    unsigned char* base = nullptr;
+    size_t bytes;       // of cells
+    size_t guard = 0;   // width of each guard region
+    size_t length = 0;
+    const Tape* previous = nullptr;
+};
+
+thread_local const Tape* Tape::active = nullptr;
+
+[[noreturn]] static void scan_out_of_tape(IO& io) {
+    Tape::escape(RUN_OFF_TAPE);
+    io.out.flush();
+    std::cerr << "Error: pointer scan ran past the end of the tape" << std::endl;
+    exit(1);
+}
+
+// An access outside the tape in a checked run, reported like the guard fault of an unchecked one
+[[noreturn]] BF_NOINLINE static void access_off_tape(IO& io) {
+    Tape::escape(RUN_OFF_TAPE);
+    io.out.flush();
+    std::cerr << "Error: pointer moved off the tape" << std::endl;
+    exit(1);
+}
+
+// A TRAP whose jump is taken: an unmatched bracket, or the entry of an endless loop ('L')
+[[noreturn]] BF_NOINLINE static void take_trap(IO& io, int kind, int position) {
+    Tape::escape(kind == 'L' ? RUN_LIMIT_EXCEEDED : RUN_UNMATCHED_BRACKET);
+    io.out.flush();
+    if (kind == 'L')
+        std::cerr << "Error: entered the endless loop at position " << position << std::endl;
+    else
+        std::cerr << "Error: Unmatched '" << char(kind) << "' at position " << position << std::endl;
+    exit(1);
+}
+
+// Writes the state of a run that continues with instruction `pc` on cell `cell` of `tape` to the
+// checkpoint file of io.watchdog, after flushing the output so the file accounts for all of it.
+// Written to a temporary file and renamed, so a run killed while writing keeps its last checkpoint.
+bool write_checkpoint(IO& io, const Tape& tape, size_t pc, int64_t cell) {
+    const Watchdog& watchdog = *io.watchdog;
+    io.out.flush();
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.code_hash = watchdog.code_hash;
+    header.pc = pc;
+    header.cell = cell;
+    header.input_offset = io.in.bytes_read();
+    header.output_offset = io.out.bytes_written();
+    if (watchdog.resume) {
+        header.input_offset += watchdog.resume->header.input_offset;
+        header.output_offset += watchdog.resume->header.output_offset;
+    }
+    header.iterations = watchdog.iterations();
+    header.page_size = uint64_t(sysconf(_SC_PAGESIZE));
+
+    std::string temp = watchdog.checkpoint_path + ".tmp" + std::to_string(getpid());
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    tape.for_each_page([&](int64_t offset, const unsigned char* data, size_t size) {
+        file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        file.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+        ++header.page_count;
+    });
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file || rename(temp.c_str(), watchdog.checkpoint_path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads a checkpoint file; false if it is missing, truncated or not a checkpoint
+bool read_checkpoint(const std::string& path, Checkpoint& checkpoint) {
+    std::ifstream file(path, std::ios::binary);
+    CheckpointHeader& header = checkpoint.header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 || header.page_size == 0 ||
+        header.page_size > (uint64_t(1) << 30) || header.page_count > Tape::size / header.page_size + 1)
+        return false;
+    checkpoint.pages.resize(size_t(header.page_count * (sizeof(int64_t) + header.page_size)));
+    return bool(file.read(reinterpret_cast<char*>(checkpoint.pages.data()), std::streamsize(checkpoint.pages.size())));
+}
+
+// Copies the tape of the checkpoint io.watchdog resumes from onto the (clear) `tape` and returns the
+// instruction to continue with; `cell` receives the current cell. The program hash was checked by
+// the caller, but the tape size is an option of the run.
+BF_NOINLINE static size_t restore_checkpoint(IO& io, Tape& tape, size_t cell_size, int64_t& cell) {
+    const Checkpoint& checkpoint = *io.watchdog->resume;
+    const CheckpointHeader& header = checkpoint.header;
+    bool fits = tape.contains(header.cell * int64_t(cell_size), cell_size);
+    for (uint64_t p = 0; p < header.page_count && fits; ++p) {
+        const unsigned char* record = checkpoint.pages.data() + p * (sizeof(int64_t) + header.page_size);
+        int64_t offset;
+        std::memcpy(&offset, record, sizeof(offset));
+        fits = tape.contains(offset, header.page_size);
+        if (fits)
+            std::memcpy(tape.begin() + offset, record + sizeof(offset), size_t(header.page_size));
+    }
+    if (!fits) {
+        std::cerr << "Error: the checkpoint does not fit the tape" << std::endl;
+        exit(1);
+    }
+    cell = header.cell;
+    return size_t(header.pc);
+}
+
+// Writes a checkpoint at a back-edge (see Watchdog); a checkpoint requested by SIGINT or SIGTERM
+// then ends the process with the usual status of that signal
+BF_NOINLINE static void take_checkpoint(IO& io, const Tape& tape, size_t pc, int64_t cell) {
+    int sig = Watchdog::take_signal();
+    bool written = write_checkpoint(io, tape, pc, cell);
+    if (!written)
+        std::cerr << "Warning: cannot write the checkpoint " << io.watchdog->checkpoint_path << std::endl;
+    if (sig == SIGINT || sig == SIGTERM) {
+        if (written)
+            std::cerr << "Checkpoint written to " << io.watchdog->checkpoint_path << std::endl;
+        exit(128 + sig);
+    }
+}
+
+// The next grant of back-edges from the watchdog of `io`; stops the run once it exceeds a limit. The
+// interpreters pass the state to continue from after the back-edge that asks, for checkpoints.
+BF_NOINLINE static uint64_t refuel(IO& io, const Tape* tape = nullptr, size_t pc = 0, int64_t cell = 0) {
+    uint64_t fuel = io.watchdog->fuel();
+    if (fuel == 0) {
+        Tape::escape(RUN_LIMIT_EXCEEDED);
+        io.out.flush();
+        std::cerr << (io.watchdog->timed_out() ? "Error: time limit exceeded" : "Error: loop iteration limit exceeded")
+                  << std::endl;
+        exit(1);
+    }
+    if (tape && io.watchdog->checkpoint_due())
+        take_checkpoint(io, *tape, pc, cell);
+    return fuel;
+}
+
+#if defined(__SSE2__)
+// Bit i is set for every cell a scan with the given stride inspects within a window of `width`
+// cells starting (stride > 0) or ending (stride < 0) at the current cell
+static uint32_t scan_mask(int stride, int width) {
+    uint32_t mask = 0;
+    for (int i = 0; i < width; i += std::abs(stride))
+        mask |= 1u << (stride > 0 ? i : width - 1 - i);
+    return mask;
+}
+
+static unsigned char* scan_sse2(unsigned char* cell, int stride, unsigned char* begin, unsigned char* end) {
+    int distance = std::abs(stride);
+    uint32_t mask = scan_mask(stride, 16);
+    size_t step = distance * ((16 + distance - 1) / distance);  // first cell to inspect in the next window
+    const __m128i zero = _mm_setzero_si128();
+    if (stride > 0) {
+        while (end - cell >= 16) {
+            __m128i cells = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cell));
+            uint32_t zeros = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(cells, zero))) & mask;
+            if (zeros)
+                return cell + __builtin_ctz(zeros);
+            cell += step;
+        }
+    } else {
+        while (cell - begin >= 15) {
+            __m128i cells = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cell - 15));
+            uint32_t zeros = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(cells, zero))) & mask;
+            if (zeros)
+                return cell - 15 + (31 - __builtin_clz(zeros));
+            cell -= step;
+        }
+    }
+    return cell;
+}
+#endif
+
+#if BF_HAVE_AVX2
+__attribute__((target("avx2")))
+static unsigned char* scan_avx2(unsigned char* cell, int stride, unsigned char* begin, unsigned char* end) {
+    int distance = std::abs(stride);
+    uint32_t mask = scan_mask(stride, 32);
+    size_t step = distance * ((32 + distance - 1) / distance);
+    const __m256i zero = _mm256_setzero_si256();
+    if (stride > 0) {
+        while (end - cell >= 32) {
+            __m256i cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell));
+            uint32_t zeros = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(cells, zero))) & mask;
+            if (zeros)
+                return cell + __builtin_ctz(zeros);
+            cell += step;
+        }
+    } else {
+        while (cell - begin >= 31) {
+            __m256i cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell - 31));
+            uint32_t zeros = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(cells, zero))) & mask;
+            if (zeros)
+                return cell - 31 + (31 - __builtin_clz(zeros));
+            cell -= step;
+        }
+    }
+    return cell;
+}
+#endif
+
+// Executes SCAN: returns the first zero cell at cell + k * stride (k >= 0) within [begin, end),
+// or nullptr if the scan runs off the tape.
+// Stride 1 uses memchr/memrchr; wider strides compare a whole vector of cells at once and mask
+// out the cells the scan skips over. Whatever is left near the tape edges is scanned one by one.
+unsigned char* scan_tape(unsigned char* cell, int stride, unsigned char* begin, unsigned char* end) {
+    if (*cell == 0)
+        return cell;
+    if (stride == 1) {
+        void* zero = std::memchr(cell, 0, end - cell);
+        return static_cast<unsigned char*>(zero);
+    }
+    if (stride == -1) {
+        void* zero = memrchr(begin, 0, cell - begin + 1);
+        return static_cast<unsigned char*>(zero);
+    }
+#if BF_HAVE_AVX2
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2 && std::abs(stride) <= 32)
+        cell = scan_avx2(cell, stride, begin, end);
+    else
+#endif
+#if defined(__SSE2__)
+    if (std::abs(stride) <= 16)
+        cell = scan_sse2(cell, stride, begin, end);
+#endif
+    for (; cell >= begin && cell < end; cell += stride)
+        if (*cell == 0)
+            return cell;
+    return nullptr;
+}
+
+// SCAN over 16- and 32-bit cells, which have no memchr equivalent
+template <class Cell>
+Cell* scan_tape(Cell* cell, int stride, Cell* begin, Cell* end) {
+    for (; cell >= begin && cell < end; cell += stride)
+        if (*cell == 0)
+            return cell;
+    return nullptr;
+}
+
+// Whether a MUL_ADD or MUL_CLEAR adding `factor` times a constant to `target` runs: always on the tape,
+// and off it only with a nonzero factor, to fault like any other access. A loop folded into MUL_ADDs
+// that never runs must not touch its targets, which may lie off the tape. Testing the target first
+// keeps the branch predictable; a branch on the factor alone costs mandelbrot 40% on every engine.
+template <class Cell>
+static inline bool mul_runs(const Cell* target, const Cell* begin, const Cell* end, Cell factor) {
+    return uintptr_t(target) - uintptr_t(begin) < uintptr_t(end) - uintptr_t(begin) || factor != 0;
+}
+
+// CLEAR_RANGE: zero is all-zero bytes at every cell width
+template <class Cell>
+static inline void clear_cells(Cell* cells, int count) {
+    std::memset(cells, 0, size_t(count) * sizeof(Cell));
+}
+
+// VEC_ADD: 8-bit cells are added 16 at a time with SSE2, wider cells rely on the auto-vectorizer
+template <class Cell>
+static inline void add_cells(Cell* cells, int count, Cell value) {
+    int k = 0;
+#if defined(__SSE2__)
+    if constexpr (sizeof(Cell) == 1) {
+        const __m128i add = _mm_set1_epi8(char(value));
+        for (; k + 16 <= count; k += 16) {
+            __m128i* chunk = reinterpret_cast<__m128i*>(cells + k);
+            _mm_storeu_si128(chunk, _mm_add_epi8(_mm_loadu_si128(chunk), add));
+        }
+    }
+#endif
+    for (; k < count; ++k)
+        cells[k] += value;
+}
+
+// Execution counts gathered by `--profile`, indexed like the bytecode
+struct Profile {
+    std::vector<uint64_t> executed;  // times the instruction ran
+    std::vector<uint64_t> work;      // loops: jumps taken; SCAN: cells stepped over / stride;
+                                     // SET_ZERO, CLEAR_RANGE: sum of the cleared values, i.e. the
+                                     // iterations of the `[-]` or multiply loops they replaced
+    uint64_t pairs[bytecode_count][bytecode_count] = {};  // [a][b]: times opcode b ran right after a
+
+    explicit Profile(size_t size) : executed(size), work(size) {}
+};
+
+// Aggregate counters of `--stats`, cheap enough to collect on every run. The dispatch and loop
+// counts come from the `Counted` instantiations of the interpreters (or from a profile) and stay
+// `unknown` on the JIT; everything else is measured outside the engines.
+struct Stats {
+    static const uint64_t unknown = UINT64_MAX;
+
+    uint64_t instructions = unknown;     // bytecode instructions dispatched
+    uint64_t loop_iterations = unknown;  // loop back-edges taken
+    uint64_t tape_pages = unknown;       // tape pages the program touched
+    uint64_t tape_high_water = unknown;  // cells from cell 0 to the end of the highest touched page
+    uint64_t bytes_in = 0, bytes_out = 0;
+    double compile_seconds = 0, optimize_seconds = 0, execute_seconds = 0;
+};
+
+// Optional instrumentation of the interpreters, combined into their `Mode` template argument. Every
+// combination is an instantiation of its own, so the plain one (0) carries none of it.
+enum InterpreterMode : unsigned {
+    PROFILED = 1,  // fill a Profile (switch interpreter only)
+    COUNTED = 2,   // count dispatches and taken back-edges into Stats
+    WATCHED = 4,   // spend the fuel of io.watchdog at taken back-edges
+};
+
+// Where a checked run is and what it has counted, handed from an engine to run_careful() and back
+template <class Cell>
+struct CarefulState {
+    size_t pc;
+    Cell* ptr;
+    uint64_t dispatched, back_edges, fuel;  // the engine's `Counted` and `Watched` registers
+};
+
+// Continues a checked run after a CHECK failed (see insert_range_checks): checks every access on its
+// own and stops with the error of the first one off the tape. Returns at the next CHECK that
+// passes, with `state.pc` at that CHECK, or at the end of the program. Does not fill a Profile.
+template <class Cell, unsigned Mode>
+BF_NOINLINE void run_careful(std::span<const Instruction> code, IO& io, Tape& tape, CarefulState<Cell>& state) {
+    constexpr bool Counted = (Mode & COUNTED) != 0;
+    constexpr bool Watched = (Mode & WATCHED) != 0;
+    Cell* const begin = tape.begin<Cell>();
+    Cell* const end = tape.end<Cell>();
+    Cell* ptr = state.ptr;
+    // The first of `count` cells at `offset`, if they are all on the tape
+    auto cells = [&](int64_t offset, int64_t count = 1) {
+        if (ptr + offset < begin || ptr + offset + count > end)
+            access_off_tape(io);
+        return ptr + offset;
+    };
+    auto back_edge = [&](size_t target) {
+        if constexpr (Counted)
+            ++state.back_edges;
+        if constexpr (Watched)
+            if (--state.fuel == 0)
+                state.fuel = refuel(io, &tape, target + 1, ptr - begin);
+    };
+
+    size_t pc = state.pc;
+    for (; pc < code.size(); ++pc) {
+        const Instruction& instr = code[pc];
+        if (instr.op == CHECK && ptr + instr.offset >= begin && ptr + instr.value < end)
+            break;
+        if constexpr (Counted)
+            ++state.dispatched;
+        switch (instr.op) {
+            case INC_PTR: ptr += instr.value; break;
+            case DEC_PTR: ptr -= instr.value; break;
+            case INC_VAL: *cells(instr.offset) += instr.value; break;
+            case DEC_VAL: *cells(instr.offset) -= instr.value; break;
+            case OUTPUT: io.out.put(*cells(instr.offset), instr.value); break;
+            case INPUT: io.in.get(cells(instr.offset), instr.value); break;
+            case SET_ZERO: *cells(instr.offset) = 0; break;
+            case MUL_ADD: case MUL_CLEAR: {
+                Cell* source = cells(instr.source);
+                if (*source == 0)
+                    break;  // a folded loop that does not run, whose targets may be off the tape
+                *cells(instr.offset) += Cell(uint32_t(instr.value) * *source);
+                if (instr.op == MUL_CLEAR)
+                    *source = 0;
+                break;
+            }
+            case CLEAR_RANGE: clear_cells(cells(instr.offset, instr.value), instr.value); break;
+            case VEC_ADD: add_cells(cells(instr.offset, instr.source), instr.source, Cell(instr.value)); break;
+            case SCAN:
+                ptr = scan_tape(cells(0), instr.value, begin, end);
+                if (!ptr) scan_out_of_tape(io);
+                break;
+            case LOOP_START:
+                if (*cells(0) == 0)
+                    pc = instr.value;
+                break;
+            case LOOP_END: case SHIFT_LOOP_END:
+                if (instr.op == SHIFT_LOOP_END)
+                    ptr += instr.source;
+                if (*cells(0) != 0) {
+                    back_edge(instr.value);
+                    pc = instr.value;
+                }
+                break;
+            case TRAP:
+                if (trap_taken(instr.value, *cells(0))) take_trap(io, instr.value, instr.offset);
+                break;
+            case CHECK:  // failed: stay careful
+                break;
+        }
+    }
+    state.pc = pc;
+    state.ptr = ptr;
+}
+
+// Cells are `Cell`, an unsigned 8-, 16- or 32-bit integer (`--cell-bits=`); all cell arithmetic wraps
+// at its width. MUL_ADD multiplies in uint32_t so 16-bit cells are not promoted to a signed int.
+template <class Cell, unsigned Mode = 0>
+void interpret_bytecode(std::span<const Instruction> bytecode, IO& io, Tape& tape, Profile* profile = nullptr,
+                        Stats* stats = nullptr) {
+    constexpr bool Profiled = (Mode & PROFILED) != 0;
+    constexpr bool Counted = (Mode & COUNTED) != 0;
+    constexpr bool Watched = (Mode & WATCHED) != 0;
+    Cell* const begin = tape.begin<Cell>();  // kept in locals: tape stores may alias `tape`
+    Cell* const end = tape.end<Cell>();
+    Cell* ptr = begin;
+    const Instruction* code = bytecode.data();
+    const size_t code_size = bytecode.size();
+
+    auto count = [profile]([[maybe_unused]] size_t pc, [[maybe_unused]] uint64_t work) {
+        if constexpr (Profiled)
+            profile->work[pc] += work;
+    };
+
+    [[maybe_unused]] uint64_t dispatched = 0, back_edges = 0;  // for `Counted`, kept in registers
+    [[maybe_unused]] uint64_t fuel = 0;                       // for `Watched`
+    size_t pc = 0;
+    if constexpr (Watched) {
+        fuel = refuel(io);
+        if (io.watchdog->resume) {
+            int64_t cell = 0;
+            pc = restore_checkpoint(io, tape, sizeof(Cell), cell);
+            ptr = begin + cell;
+        }
+    }
+    // At the back-edge to `target`, after which the run continues with target + 1
+    auto back_edge = [&]([[maybe_unused]] size_t target) {
+        if constexpr (Counted)
+            ++back_edges;
+        if constexpr (Watched)
+            if (--fuel == 0) [[unlikely]]
+                fuel = refuel(io, &tape, target + 1, ptr - begin);
+    };
+
+    [[maybe_unused]] unsigned previous = bytecode_count;  // opcode that ran last, none yet
+    for (; pc < code_size; ++pc) {
+        const auto& instr = code[pc];
+        if constexpr (Counted)
+            ++dispatched;
+        if constexpr (Profiled) {
+            ++profile->executed[pc];
+            if (previous != bytecode_count)
+                ++profile->pairs[previous][instr.op];
+            previous = instr.op;
+        }
+        switch (instr.op) {
+            case INC_PTR: ptr += instr.value; break;
+            case DEC_PTR: ptr -= instr.value; break;
+            case INC_VAL: ptr[instr.offset] += instr.value; break;
+            case DEC_VAL: ptr[instr.offset] -= instr.value; break;
+            case OUTPUT: io.out.put(ptr[instr.offset], instr.value); break;
+            case INPUT: io.in.get(ptr + instr.offset, instr.value); break;
+            case SET_ZERO:
+                count(pc, ptr[instr.offset]);
+                ptr[instr.offset] = 0;
+                break;
+            case MUL_ADD:
+                if (mul_runs(ptr + instr.offset, begin, end, ptr[instr.source]))
+                    ptr[instr.offset] += Cell(uint32_t(instr.value) * ptr[instr.source]);
+                break;
+            case MUL_CLEAR:
+                count(pc, ptr[instr.source]);
+                if (mul_runs(ptr + instr.offset, begin, end, ptr[instr.source])) {
+                    ptr[instr.offset] += Cell(uint32_t(instr.value) * ptr[instr.source]);
+                    ptr[instr.source] = 0;
+                }
+                break;
+            case CLEAR_RANGE:
+                if constexpr (Profiled)
+                    for (int j = 0; j < instr.value; ++j)
+                        count(pc, ptr[instr.offset + j]);
+                clear_cells(ptr + instr.offset, instr.value);
+                break;
+            case VEC_ADD: add_cells(ptr + instr.offset, instr.source, Cell(instr.value)); break;
+            case SCAN: {
+                Cell* from = ptr;
+                ptr = scan_tape(ptr, instr.value, begin, end);
+                if (!ptr) scan_out_of_tape(io);
+                count(pc, uint64_t((ptr - from) / instr.value));
+                break;
+            }
+            case LOOP_START:
+                if (*ptr == 0) {
+                    count(pc, 1);
+                    pc = instr.value;  // continue after the LOOP_END
+                }
+                break;
+            case LOOP_END:
+                if (*ptr != 0) {
+                    count(pc, 1);
+                    back_edge(instr.value);
+                    pc = instr.value;  // continue with the first instruction of the body
+                }
+                break;
+            case SHIFT_LOOP_END:
+                ptr += instr.source;
+                if (*ptr != 0) {
+                    count(pc, 1);
+                    back_edge(instr.value);
+                    pc = instr.value;
+                }
+                break;
+            case TRAP:
+                if (trap_taken(instr.value, *ptr)) take_trap(io, instr.value, instr.offset);
+                break;
+            case CHECK:
+                if (ptr + instr.offset < begin || ptr + instr.value >= end) [[unlikely]] {
+                    CarefulState<Cell> state = {pc + 1, ptr, dispatched, back_edges, fuel};
+                    run_careful<Cell, Mode>(bytecode, io, tape, state);
+                    pc = state.pc - 1;  // the passing CHECK, or the end
+                    ptr = state.ptr;
+                    dispatched = state.dispatched;
+                    back_edges = state.back_edges;
+                    fuel = state.fuel;
+                }
+                break;
+        }
+    }
+    if constexpr (Counted) {
+        stats->instructions = dispatched;
+        stats->loop_iterations = back_edges;
+    }
+}
+
+#if defined(__GNUC__)
+#define BF_HAVE_THREADED 1
+
+// Direct-threaded interpreter: the bytecode is translated once into an array of handler
+// addresses (GCC/Clang labels-as-values), and every handler jumps straight to the next one.
+// This removes the bounds check and loop increment of the switch loop and gives each opcode
+// its own indirect jump, which the branch predictor can learn separately. Handlers are stored as
+// 32-bit distances from the first one, which keeps a threaded instruction at 16 bytes.
+// Supports the COUNTED and WATCHED modes.
+template <class Cell, unsigned Mode = 0>
+void interpret_threaded(std::span<const Instruction> bytecode, IO& io, Tape& tape, Stats* stats = nullptr) {
+    constexpr bool Counted = (Mode & COUNTED) != 0;
+    constexpr bool Watched = (Mode & WATCHED) != 0;
+    struct ThreadedInstr {
+        int32_t handler;  // distance of the handler from &&do_inc_ptr in bytes
+        int16_t source;
+        int32_t value;    // index of the matching LOOP_START/LOOP_END for loops
+        int32_t offset;
+    };
+    static_assert(sizeof(ThreadedInstr) == 16, "ThreadedInstr should stay packed");
+
+#define HANDLER(label) int32_t(static_cast<const char*>(&&label) - static_cast<const char*>(&&do_inc_ptr))
+    static const int32_t handlers[] = {
+        HANDLER(do_inc_ptr), HANDLER(do_dec_ptr), HANDLER(do_inc_val), HANDLER(do_dec_val),
+        HANDLER(do_output), HANDLER(do_input), HANDLER(do_loop_start), HANDLER(do_loop_end),
+        HANDLER(do_set_zero), HANDLER(do_clear_range), HANDLER(do_mul_add), HANDLER(do_scan),
+        HANDLER(do_vec_add), HANDLER(do_trap), HANDLER(do_mul_clear), HANDLER(do_shift_loop_end),
+        HANDLER(do_check),
+    };
+
+    // Translate to threaded code, terminated by a HALT handler so dispatch needs no bounds check.
+    // The buffer is reused by later runs on this thread and survives a VM run that faults out.
+    static thread_local std::vector<ThreadedInstr> code;
+    code.resize(bytecode.size() + 1);
+    for (size_t pc = 0; pc < bytecode.size(); ++pc) {
+        const Instruction& instr = bytecode[pc];
+        code[pc] = {handlers[instr.op], instr.source, instr.value, instr.offset};
+    }
+    code[bytecode.size()] = {HANDLER(do_halt), 0, 0, 0};
+#undef HANDLER
+
+    Cell* const begin = tape.begin<Cell>();  // kept in locals: tape stores may alias `tape` and `code`
+    Cell* const end = tape.end<Cell>();
+    Cell* ptr = begin;
+    const ThreadedInstr* const start = code.data();
+    const ThreadedInstr* ip = start;
+    [[maybe_unused]] uint64_t dispatched = 0, back_edges = 0;
+    [[maybe_unused]] uint64_t fuel = 0;
+    if constexpr (Watched) {
+        fuel = refuel(io);
+        if (io.watchdog->resume) {
+            int64_t cell = 0;
+            ip = start + restore_checkpoint(io, tape, sizeof(Cell), cell);
+            ptr = begin + cell;
+        }
+    }
+
+#define DISPATCH() do { \
+        if constexpr (Counted) ++dispatched; \
+        goto *(static_cast<const char*>(&&do_inc_ptr) + ip->handler); \
+    } while (0)
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define BACK_EDGE() do { \
+        if constexpr (Counted) ++back_edges; \
+        if constexpr (Watched) \
+            if (--fuel == 0) [[unlikely]] fuel = refuel(io, &tape, size_t(ip->value) + 1, ptr - begin); \
+    } while (0)
+
+    DISPATCH();
+
+do_inc_ptr: ptr += ip->value; NEXT();
+do_dec_ptr: ptr -= ip->value; NEXT();
+do_inc_val: ptr[ip->offset] += ip->value; NEXT();
+do_dec_val: ptr[ip->offset] -= ip->value; NEXT();
+do_output: io.out.put(ptr[ip->offset], ip->value); NEXT();
+do_input: io.in.get(ptr + ip->offset, ip->value); NEXT();
+do_set_zero: ptr[ip->offset] = 0; NEXT();
+do_clear_range: clear_cells(ptr + ip->offset, ip->value); NEXT();
+do_vec_add: add_cells(ptr + ip->offset, ip->source, Cell(ip->value)); NEXT();
+do_mul_add:
+    if (mul_runs(ptr + ip->offset, begin, end, ptr[ip->source]))
+        ptr[ip->offset] += Cell(uint32_t(ip->value) * ptr[ip->source]);
+    NEXT();
+do_mul_clear:
+    if (mul_runs(ptr + ip->offset, begin, end, ptr[ip->source])) {
+        ptr[ip->offset] += Cell(uint32_t(ip->value) * ptr[ip->source]);
+        ptr[ip->source] = 0;
+    }
+    NEXT();
+do_scan: {
+    ptr = scan_tape(ptr, ip->value, begin, end);
+    if (!ptr) scan_out_of_tape(io);
+    NEXT();
+}
+do_loop_start:
+    if (*ptr == 0)
+        ip = start + ip->value;
+    NEXT();
+do_loop_end:
+    if (*ptr != 0) {
+        BACK_EDGE();
+        ip = start + ip->value;
+    }
+    NEXT();
+do_shift_loop_end:
+    ptr += ip->source;
+    if (*ptr != 0) {
+        BACK_EDGE();
+        ip = start + ip->value;
+    }
+    NEXT();
+do_trap:
+    if (trap_taken(ip->value, *ptr)) take_trap(io, ip->value, ip->offset);
+    NEXT();
+do_check:
+    if (ptr + ip->offset < begin || ptr + ip->value >= end) [[unlikely]] {
+        CarefulState<Cell> state = {size_t(ip - start) + 1, ptr, dispatched, back_edges, fuel};
+        run_careful<Cell, Mode>(bytecode, io, tape, state);
+        ip = start + state.pc;  // the passing CHECK, or the HALT
+        ptr = state.ptr;
+        dispatched = state.dispatched;
+        back_edges = state.back_edges;
+        fuel = state.fuel;
+        DISPATCH();
+    }
+    NEXT();
+do_halt:
+    if constexpr (Counted) {
+        stats->instructions = dispatched - 1;  // not the HALT
+        stats->loop_iterations = back_edges;
+    }
+    return;
+
+#undef BACK_EDGE
+#undef NEXT
+#undef DISPATCH
+}
+#else
+#define BF_HAVE_THREADED 0
+#endif
+
+#if BF_HAVE_JIT
+// Helpers called from JIT code (System V ABI: rdi, rsi, rdx, rcx, r8)
+static void jit_output(IO* io, unsigned char* cell, int count) {
+    io->out.put(*cell, count);
+}
+
+static void jit_input(IO* io, unsigned char* cell, int count) {
+    io->in.get(cell, count);
+}
+
+static void jit_unmatched_open(IO* io, unsigned char*, int position) {
+    take_trap(*io, '[', position);
+}
+
+static void jit_unmatched_close(IO* io, unsigned char*, int position) {
+    take_trap(*io, ']', position);
+}
+
+static void jit_endless_loop(IO* io, unsigned char*, int position) {
+    take_trap(*io, 'L', position);
+}
+
+static uint64_t jit_refuel(IO* io) {
+    return refuel(*io);
+}
+
+static unsigned char* jit_scan(unsigned char* cell, int stride, unsigned char* begin, unsigned char* end, IO* io) {
+    unsigned char* zero = scan_tape(cell, stride, begin, end);
+    if (!zero) scan_out_of_tape(*io);
+    return zero;
+}
+
+static const uint8_t JCC_AE = 0x3, JCC_E = 0x4, JCC_NE = 0x5;
+
+// Minimal x86-64 encoder for the few instruction forms the JIT needs.
+// The tape pointer lives in rbx, the tape bounds in r12/r13, the IO object in r14 and the watchdog
+// fuel in r15; all of them are callee-saved and therefore survive the helper calls.
+struct X86Emitter {
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void imm32(int32_t v) {
+        for (int i = 0; i < 4; ++i)
+            byte(uint8_t(uint32_t(v) >> (8 * i)));
+    }
+    void imm64(uint64_t v) {
+        for (int i = 0; i < 8; ++i)
+            byte(uint8_t(v >> (8 * i)));
+    }
+
+    // ModRM (+ displacement) for the memory operand [rbx + disp]
+    void mem_rbx(uint8_t reg, int32_t disp) {
+        if (disp == 0) {
+            byte(0x03 | reg << 3);
+        } else if (disp >= -128 && disp <= 127) {
+            byte(0x43 | reg << 3);
+            byte(uint8_t(disp));
+        } else {
+            byte(0x83 | reg << 3);
+            imm32(disp);
+        }
+    }
+
+    void add_rbx(int32_t v) {           // add rbx, imm
+        if (v >= -128 && v <= 127) { byte(0x48); byte(0x83); byte(0xC3); byte(uint8_t(v)); }
+        else { byte(0x48); byte(0x81); byte(0xC3); imm32(v); }
+    }
+    void add_cell(int32_t disp, uint8_t v) { byte(0x80); mem_rbx(0, disp); byte(v); }  // add byte [rbx+disp], imm8
+    void set_cell(int32_t disp, uint8_t v) { byte(0xC6); mem_rbx(0, disp); byte(v); }  // mov byte [rbx+disp], imm8
+    void cmp_cell_zero(int32_t disp) { byte(0x80); mem_rbx(7, disp); byte(0); }        // cmp byte [rbx+disp], 0
+    void load_cell_eax(int32_t disp) { byte(0x0F); byte(0xB6); mem_rbx(0, disp); }   // movzx eax, byte [rbx+disp]
+
+    // movdqu xmm0, [rbx+disp] / movdqu [rbx+disp], xmm0
+    void load_xmm0(int32_t disp) { byte(0xF3); byte(0x0F); byte(0x6F); mem_rbx(0, disp); }
+    void store_xmm0(int32_t disp) { byte(0xF3); byte(0x0F); byte(0x7F); mem_rbx(0, disp); }
+
+    // CLEAR_RANGE: 16 cells per SSE store, single bytes for the rest
+    void fill_cells(int32_t disp, int32_t count) {
+        int32_t k = 0;
+        if (count >= 16) {
+            byte(0x66); byte(0x0F); byte(0xEF); byte(0xC0);       // pxor xmm0, xmm0
+            for (; k + 16 <= count; k += 16)
+                store_xmm0(disp + k);
+        }
+        for (; k < count; ++k)
+            set_cell(disp + k, 0);
+    }
+
+    // VEC_ADD: paddb with the amount broadcast into xmm1 for every 16 cells, single bytes for the rest
+    void add_cells(int32_t disp, int32_t count, uint8_t v) {
+        int32_t k = 0;
+        if (count >= 16) {
+            byte(0xB8); imm32(int32_t(v * 0x01010101u));          // mov eax, v x 4
+            byte(0x66); byte(0x0F); byte(0x6E); byte(0xC8);       // movd xmm1, eax
+            byte(0x66); byte(0x0F); byte(0x70); byte(0xC9); byte(0); // pshufd xmm1, xmm1, 0
+            for (; k + 16 <= count; k += 16) {
+                load_xmm0(disp + k);
+                byte(0x66); byte(0x0F); byte(0xFC); byte(0xC1);   // paddb xmm0, xmm1
+                store_xmm0(disp + k);
+            }
+        }
+        for (; k < count; ++k)
+            add_cell(disp + k, v);
+    }
+
+    // byte [rbx+disp] += al * factor (only the low byte of the product matters), where al is the cell
+    // at `source`. A target off the tape is only written with a nonzero factor, to fault like any other
+    // access (mul_runs()); the factor cell is on it, so only the end on the side of the target is tested.
+    void mul_add_cell(int32_t disp, int32_t source, int32_t factor) {
+        byte(0x48); byte(0x8D); mem_rbx(2, disp);                 // lea rdx, [rbx+disp]
+        if (disp < source) {
+            byte(0x4C); byte(0x39); byte(0xE2);                   // cmp rdx, r12
+        } else {
+            byte(0x4C); byte(0x39); byte(0xEA);                   // cmp rdx, r13
+            byte(0xF5);                                           // cmc: carry = rdx >= r13
+        }
+        size_t on_tape = jcc(JCC_AE);
+        byte(0x85); byte(0xC0);                                   // test eax, eax
+        size_t zero = jcc(JCC_E);
+        patch_rel32(on_tape, code.size());
+        if (factor == 1) { byte(0x00); mem_rbx(0, disp); }        // add byte [rbx+disp], al
+        else if (factor == -1) { byte(0x28); mem_rbx(0, disp); }  // sub byte [rbx+disp], al
+        else {
+            byte(0x69); byte(0xC8); imm32(factor);                // imul ecx, eax, factor
+            byte(0x00); mem_rbx(1, disp);                         // add byte [rbx+disp], cl
+        }
+        patch_rel32(zero, code.size());
+    }
+
+    // jcc rel32 with a placeholder target; returns the offset just past the instruction
+    size_t jcc(uint8_t cc) {
+        byte(0x0F); byte(0x80 | cc); imm32(0);
+        return code.size();
+    }
+    // jmp rel32, likewise
+    size_t jmp() {
+        byte(0xE9); imm32(0);
+        return code.size();
+    }
+    void patch_rel32(size_t after, size_t target) {
+        int32_t rel = int32_t(target) - int32_t(after);
+        std::memcpy(&code[after - 4], &rel, 4);
+    }
+
+    // helper(r14, rbx + disp, count) through an absolute address, so the mapping can live anywhere
+    void call_io(void (*fn)(IO*, unsigned char*, int), int32_t disp, int32_t count) {
+        byte(0x4C); byte(0x89); byte(0xF7);          // mov rdi, r14
+        byte(0x48); byte(0x8D); mem_rbx(6, disp);    // lea rsi, [rbx+disp]
+        byte(0xBA); imm32(count);                    // mov edx, count
+        call(reinterpret_cast<const void*>(fn));
+    }
+
+    // r15 = jit_refuel(r14)
+    void call_refuel() {
+        byte(0x4C); byte(0x89); byte(0xF7);          // mov rdi, r14
+        call(reinterpret_cast<const void*>(jit_refuel));
+        byte(0x49); byte(0x89); byte(0xC7);          // mov r15, rax
+    }
+
+    // rbx = jit_scan(rbx, stride, r12, r13, r14)
+    void call_scan(int32_t stride) {
+        byte(0x48); byte(0x89); byte(0xDF);          // mov rdi, rbx
+        byte(0xBE); imm32(stride);                   // mov esi, stride
+        byte(0x4C); byte(0x89); byte(0xE2);          // mov rdx, r12
+        byte(0x4C); byte(0x89); byte(0xE9);          // mov rcx, r13
+        byte(0x4D); byte(0x89); byte(0xF0);          // mov r8, r14
+        call(reinterpret_cast<const void*>(jit_scan));
+        byte(0x48); byte(0x89); byte(0xC3);          // mov rbx, rax
+    }
+
+    void call(const void* fn) {
+        byte(0x48); byte(0xB8); imm64(uint64_t(fn)); // mov rax, fn
+        byte(0xFF); byte(0xD0);                      // call rax
+    }
+};
+
+// Translates the optimized bytecode into native code that returns the final tape pointer and fuel:
+// JitResult fn(unsigned char* ptr, unsigned char* tape_begin, unsigned char* tape_end, IO* io, uint64_t fuel)
+// `watched` code counts taken back-edges down from `fuel` in r15 and refuels from io->watchdog when it
+// reaches zero; the fuel it returns is what is left for the caller.
+std::vector<uint8_t> jit_compile(std::span<const Instruction> bytecode, bool watched = false) {
+    X86Emitter x;
+    std::stack<size_t> loop_stack; // offsets just past each LOOP_START's forward jump
+
+    x.byte(0x53);                                  // push rbx
+    x.byte(0x41); x.byte(0x54);                    // push r12
+    x.byte(0x41); x.byte(0x55);                    // push r13
+    x.byte(0x41); x.byte(0x56);                    // push r14
+    x.byte(0x41); x.byte(0x57);                    // push r15 (also aligns the stack to 16 bytes for calls)
+    x.byte(0x48); x.byte(0x89); x.byte(0xFB);     // mov rbx, rdi
+    x.byte(0x49); x.byte(0x89); x.byte(0xF4);     // mov r12, rsi
+    x.byte(0x49); x.byte(0x89); x.byte(0xD5);     // mov r13, rdx
+    x.byte(0x49); x.byte(0x89); x.byte(0xCE);     // mov r14, rcx
+    x.byte(0x4D); x.byte(0x89); x.byte(0xC7);     // mov r15, r8
+
+    for (const Instruction& instr : bytecode) {
+        switch (instr.op) {
+            case INC_PTR: x.add_rbx(instr.value); break;
+            case DEC_PTR: x.add_rbx(-instr.value); break;
+            case INC_VAL: x.add_cell(instr.offset, uint8_t(instr.value)); break;
+            case DEC_VAL: x.add_cell(instr.offset, uint8_t(-instr.value)); break;
+            case OUTPUT: x.call_io(jit_output, instr.offset, instr.value); break;
+            case INPUT: x.call_io(jit_input, instr.offset, instr.value); break;
+            case SET_ZERO: x.set_cell(instr.offset, 0); break;
+            case MUL_ADD: case MUL_CLEAR:
+                x.load_cell_eax(instr.source);
+                x.mul_add_cell(instr.offset, instr.source, instr.value);
+                if (instr.op == MUL_CLEAR)
+                    x.set_cell(instr.source, 0);
+                break;
+            case CLEAR_RANGE: x.fill_cells(instr.offset, instr.value); break;
+            case VEC_ADD: x.add_cells(instr.offset, instr.source, uint8_t(instr.value)); break;
+            case SCAN: {
+                // scan_tape stops at the ends of the tape like the interpreters, so every stride goes
+                // through it; the call is skipped when the current cell is already zero
+                x.cmp_cell_zero(0);
+                size_t done = x.jcc(JCC_E);
+                x.call_scan(instr.value);
+                x.patch_rel32(done, x.code.size());
+                break;
+            }
+            case LOOP_START:
+                x.cmp_cell_zero(0);
+                loop_stack.push(x.jcc(JCC_E));
+                break;
+            case LOOP_END: case SHIFT_LOOP_END: {
+                if (instr.op == SHIFT_LOOP_END)
+                    x.add_rbx(instr.source);
+                size_t body = loop_stack.top();
+                loop_stack.pop();
+                x.cmp_cell_zero(0);
+                if (watched) {
+                    size_t done = x.jcc(JCC_E);
+                    x.byte(0x49); x.byte(0xFF); x.byte(0xCF);  // dec r15
+                    x.patch_rel32(x.jcc(JCC_NE), body);
+                    x.call_refuel();
+                    x.patch_rel32(x.jmp(), body);
+                    x.patch_rel32(done, x.code.size());
+                } else {
+                    x.patch_rel32(x.jcc(JCC_NE), body);
+                }
+                x.patch_rel32(body, x.code.size());
+                break;
+            }
+            case TRAP: {
+                x.cmp_cell_zero(0);
+                size_t safe = x.jcc(instr.value == '[' ? JCC_NE : JCC_E);
+                x.call_io(instr.value == '[' ? jit_unmatched_open : instr.value == ']' ? jit_unmatched_close
+                                                                                       : jit_endless_loop,
+                          0, instr.offset);
+                x.patch_rel32(safe, x.code.size());
+                break;
+            }
+            case CHECK:  // the guard pages check the accesses of native code
+                break;
+        }
+    }
+
+    x.byte(0x48); x.byte(0x89); x.byte(0xD8);     // mov rax, rbx
+    x.byte(0x4C); x.byte(0x89); x.byte(0xFA);     // mov rdx, r15
+    x.byte(0x41); x.byte(0x5F);                    // pop r15
+    x.byte(0x41); x.byte(0x5E);                    // pop r14
+    x.byte(0x41); x.byte(0x5D);                    // pop r13
+    x.byte(0x41); x.byte(0x5C);                    // pop r12
+    x.byte(0x5B);                                  // pop rbx
+    x.byte(0xC3);                                  // ret
+    return x.code;
+}
+
+// Returned by JIT code in rax:rdx
+struct JitResult {
+    unsigned char* ptr;
+    uint64_t fuel;
+};
+
+// jit_compile() output in its own executable mapping
+class JitFunction {
+public:
+    using Entry = JitResult (*)(unsigned char* ptr, unsigned char* tape_begin, unsigned char* tape_end, IO* io,
+                                uint64_t fuel);
+
+    explicit JitFunction(std::span<const Instruction> bytecode, bool watched = false) {
+        std::vector<uint8_t> code = jit_compile(bytecode, watched);
+        size = code.size();
+
+        // Map writable, copy, then flip to executable so the mapping is never W+X
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            std::cerr << "Error: Cannot allocate executable memory for JIT" << std::endl;
+            exit(1);
+        }
+        std::memcpy(mem, code.data(), size);
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            std::cerr << "Error: Cannot make JIT code executable" << std::endl;
+            exit(1);
+        }
+    }
+
+    ~JitFunction() { munmap(mem, size); }
+
+    JitFunction(const JitFunction&) = delete;
+    JitFunction& operator=(const JitFunction&) = delete;
+
+    Entry entry() const { return reinterpret_cast<Entry>(mem); }
+
+private:
+    void* mem;
+    size_t size;
+};
+
+// Runs code compiled once (`--batch`, Program) on `tape`
+void run_jit(const JitFunction& function, IO& io, Tape& tape) {
+    function.entry()(tape.begin(), tape.begin(), tape.end(), &io, io.watchdog ? refuel(io) : 0);
+}
+
+void interpret_jit(std::span<const Instruction> bytecode, IO& io, Tape& tape) {
+    JitFunction function(bytecode, io.watchdog != nullptr);
+    run_jit(function, io, tape);
+}
+
+// Loops of the tiered engine that would reach further than this many cells stay interpreted
+static const uint64_t max_tier_reach = 1 << 16;
+
+// The guard width a tape for interpret_tiered() needs: the reach of the startup bytecode and of the
+// loops it compiles. The passes may fold every pointer move of a loop body, inner loops that become
+// straight-line code included, into offsets, so a compiled loop can reach as far as the sum of its
+// moves. The largest such sum is capped at max_tier_reach; interpret_tiered() checks every compiled
+// loop against the tape it runs on and leaves the ones that do not fit interpreted.
+uint64_t tiered_reach(std::span<const Instruction> bytecode) {
+    std::vector<uint64_t> moves = {0};  // of each open loop, the program at the bottom
+    uint64_t max_moves = 0;
+    for (const Instruction& instr : bytecode) {
+        if (instr.op == INC_PTR || instr.op == DEC_PTR || instr.op == SCAN)
+            moves.back() += uint64_t(std::abs(int64_t(instr.value)));
+        else if (instr.op == SHIFT_LOOP_END)
+            moves.back() += uint64_t(std::abs(int64_t(instr.source)));
+        if (instr.op == LOOP_START) {
+            moves.push_back(0);
+        } else if (closes_loop(instr.op)) {
+            uint64_t loop = moves.back();
+            moves.pop_back();
+            moves.back() += loop;
+            max_moves = std::max(max_moves, loop);
+        }
+    }
+    return std::max(tape_reach(bytecode), std::min(max_moves, max_tier_reach));
+}
+
+// What interpret_tiered() allocates for a run: the back-edge counts and the compiled loops. The
+// caller owns it, so that a run-time error that jumps to a recovery point out of the engine leaks
+// nothing; a state can be reused for the next run.
+struct TieredState {
+    std::vector<uint32_t> back_edges;  // by LOOP_END
+    std::vector<int32_t> native;       // LOOP_START -> index into `loops`
+    std::vector<std::unique_ptr<JitFunction>> loops;
+};
+
+// Tiered engine: the program starts on an interpreter over cheaply optimized bytecode that counts loop
+// back-edges. When a loop has jumped back `threshold` times, its slice of the bytecode is run through
+// the full pass pipeline and the JIT, and its LOOP_START is patched to call the native loop, which
+// takes the tape pointer and returns it when the loop exits. The current iteration transfers at once:
+// the cell is nonzero at a taken back-edge, so entering the native loop from its start is equivalent.
+// Nested hot loops are compiled on their own first; an outer loop that gets hot later is compiled
+// again as a whole. 8-bit cells only, like the JIT. `stats` only gets the tape usage. The guards of
+// `tape` must cover the tape_reach() of `bytecode`; a hot loop whose optimized code reaches further
+// than they do is not compiled.
+void interpret_tiered(std::span<const Instruction> bytecode, IO& io, Tape& tape, const PassManager& optimizer,
+                      uint32_t threshold, TieredState& state, Stats* stats = nullptr) {
+    unsigned char* const begin = tape.begin();
+    unsigned char* const end = tape.end();
+    unsigned char* ptr = begin;
+    const Instruction* code = bytecode.data();
+    const size_t code_size = bytecode.size();
+
+    std::vector<uint32_t>& back_edges = state.back_edges;
+    std::vector<int32_t>& native = state.native;
+    std::vector<std::unique_ptr<JitFunction>>& loops = state.loops;
+    back_edges.assign(code_size, 0);
+    native.assign(code_size, -1);
+    loops.clear();
+    uint64_t fuel = io.watchdog ? refuel(io) : 0;
+
+    auto promote = [&](size_t start, size_t stop) {
+        std::vector<Instruction> slice(code + start, code + stop + 1);
+        for (Instruction& instr : slice)
+            if (instr.op == LOOP_START || closes_loop(instr.op))
+                instr.value -= int32_t(start);
+        PassManager passes = optimizer;
+        passes.set_pass("-known");  // both assume the code starts on a fresh tape
+        passes.set_pass("-prefix");
+        passes.run(slice);
+        if (tape_reach(slice) >= tape.guard_cells())
+            return JitFunction::Entry(nullptr);
+        native[start] = int32_t(loops.size());
+        loops.push_back(std::make_unique<JitFunction>(slice, io.watchdog != nullptr));
+        return loops.back()->entry();
+    };
+
+    for (size_t pc = 0; pc < code_size; ++pc) {
+        const auto& instr = code[pc];
+        switch (instr.op) {
+            case INC_PTR: ptr += instr.value; break;
+            case DEC_PTR: ptr -= instr.value; break;
+            case INC_VAL: ptr[instr.offset] += instr.value; break;
+            case DEC_VAL: ptr[instr.offset] -= instr.value; break;
+            case OUTPUT: io.out.put(ptr[instr.offset], instr.value); break;
+            case INPUT: io.in.get(ptr + instr.offset, instr.value); break;
+            case SET_ZERO: ptr[instr.offset] = 0; break;
+            case MUL_ADD:
+                if (mul_runs(ptr + instr.offset, begin, end, ptr[instr.source]))
+                    ptr[instr.offset] += uint8_t(uint32_t(instr.value) * ptr[instr.source]);
+                break;
+            case MUL_CLEAR:
+                if (mul_runs(ptr + instr.offset, begin, end, ptr[instr.source])) {
+                    ptr[instr.offset] += uint8_t(uint32_t(instr.value) * ptr[instr.source]);
+                    ptr[instr.source] = 0;
+                }
+                break;
+            case CLEAR_RANGE: clear_cells(ptr + instr.offset, instr.value); break;
+            case VEC_ADD: add_cells(ptr + instr.offset, instr.source, (unsigned char)instr.value); break;
+            case SCAN:
+                ptr = scan_tape(ptr, instr.value, begin, end);
+                if (!ptr) scan_out_of_tape(io);
+                break;
+            case LOOP_START:
+                if (native[pc] >= 0) {
+                    JitResult result = loops[size_t(native[pc])]->entry()(ptr, begin, end, &io, fuel);
+                    ptr = result.ptr;
+                    fuel = result.fuel;
+                    pc = instr.value;
+                } else if (*ptr == 0) {
+                    pc = instr.value;  // continue after the LOOP_END
+                }
+                break;
+            case LOOP_END: case SHIFT_LOOP_END:
+                if (instr.op == SHIFT_LOOP_END)
+                    ptr += instr.source;
+                if (*ptr != 0) {
+                    size_t start = size_t(instr.value);
+                    if (io.watchdog && --fuel == 0) [[unlikely]]
+                        fuel = refuel(io);
+                    if (++back_edges[pc] == threshold && native[start] < 0) {
+                        if (JitFunction::Entry entry = promote(start, pc)) {
+                            JitResult result = entry(ptr, begin, end, &io, fuel);
+                            ptr = result.ptr;
+                            fuel = result.fuel;
+                            break;  // the native loop ran to completion: continue after the LOOP_END
+                        }
+                    }
+                    pc = start;  // continue with the first instruction of the body
+                }
+                break;
+            case TRAP:
+                if (trap_taken(instr.value, *ptr)) take_trap(io, instr.value, instr.offset);
+                break;
+            case CHECK:  // not in the bytecode of the tiered engine, which relies on the guard pages
+                break;
+        }
+    }
+    if (stats)
+        tape.usage(1, stats->tape_pages, stats->tape_high_water);
+}
+
+// Same on a tape of its own
+void interpret_tiered(std::span<const Instruction> bytecode, IO& io, const PassManager& optimizer, uint32_t threshold,
+                      Stats* stats = nullptr) {
+    Tape tape(tiered_reach(bytecode), &io.out);
+    TieredState state;
+    interpret_tiered(bytecode, io, tape, optimizer, threshold, state, stats);
+}
+#endif
+
+static const char* const bytecode_names[] = {
+    "INC_PTR", "DEC_PTR", "INC_VAL", "DEC_VAL", "OUTPUT", "INPUT",
+    "LOOP_START", "LOOP_END", "SET_ZERO", "CLEAR_RANGE", "MUL_ADD", "SCAN", "VEC_ADD", "TRAP",
+    "MUL_CLEAR", "SHIFT_LOOP_END", "CHECK",
+};
+static_assert(sizeof(bytecode_names) / sizeof(bytecode_names[0]) == bytecode_count, "name every opcode");
+
+// Prints one instruction in the `-c` format
+void print_instruction(std::ostream& os, const Instruction& instr) {
+    // Cell offsets are printed as `@offset` when the instruction does not access memory[ptr]
+    std::string at = instr.offset ? '@' + std::to_string(instr.offset) : std::string();
+    switch (instr.op) {
+        case INC_PTR: os << "INC_PTR " << instr.value; break;
+        case DEC_VAL: os << "DEC_VAL " << instr.value << at; break;
+        case INC_VAL: os << "INC_VAL " << instr.value << at; break;
+        case DEC_PTR: os << "DEC_PTR " << instr.value; break;
+        case OUTPUT: os << "OUTPUT " << instr.value << at; break;
+        case INPUT: os << "INPUT " << instr.value << at; break;
+        case SET_ZERO: os << "SET_ZERO" << at; break;
+        case CLEAR_RANGE: os << "CLEAR_RANGE " << instr.value << at; break;
+        case MUL_ADD: os << "MUL_ADD " << instr.value << at << " <-@" << instr.source; break;
+        case SCAN: os << "SCAN " << instr.value; break;
+        case VEC_ADD: os << "VEC_ADD " << instr.value << 'x' << instr.source << at; break;
+        case LOOP_START: os << "LOOP_START"; break;
+        case LOOP_END: os << "LOOP_END"; break;
+        case TRAP: os << "TRAP '" << char(instr.value) << "' at " << instr.offset; break;
+        case MUL_CLEAR: os << "MUL_CLEAR " << instr.value << at << " <-@" << instr.source; break;
+        case SHIFT_LOOP_END: os << "SHIFT_LOOP_END " << instr.source; break;
+        case CHECK: os << "CHECK " << instr.offset << ".." << instr.value; break;
+        default: os << "UNKNOWN"; break;
+    }
+}
+
+// `--profile` report: executions per opcode, the hottest loops that survived optimization with their
+// source position and iteration counts, and the hottest loops the optimizer collapsed into a single
+// SCAN, SET_ZERO or CLEAR_RANGE (a multiply loop is its MUL_ADDs followed by the SET_ZERO).
+void print_profile(std::ostream& os, std::span<const Instruction> code, const Profile& profile) {
+    static const size_t top = 10;
+    char line[160];
+
+    uint64_t total = 0;
+    uint64_t per_op[bytecode_count] = {};
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        total += profile.executed[pc];
+        per_op[code[pc].op] += profile.executed[pc];
+    }
+    os << "Profile: " << total << " instructions executed\n";
+    for (unsigned op = 0; op < bytecode_count; ++op) {
+        if (!per_op[op])
+            continue;
+        snprintf(line, sizeof(line), "  %-12s %16llu %6.2f%%\n", bytecode_names[op],
+                 static_cast<unsigned long long>(per_op[op]), 100.0 * double(per_op[op]) / double(total));
+        os << line;
+    }
+
+    // Entered `entries` times, so the body started every time it was not skipped and after every jump back
+    struct LoopRow {
+        size_t start;
+        uint64_t entries, iterations;
+    };
+    std::vector<LoopRow> loops;
+    std::vector<size_t> enclosing(code.size(), SIZE_MAX);  // innermost surviving loop around each instruction
+    std::vector<size_t> open;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        enclosing[pc] = open.empty() ? SIZE_MAX : open.back();
+        if (code[pc].op == LOOP_START) {
+            open.push_back(pc);
+        } else if (closes_loop(code[pc].op)) {
+            size_t start = open.back();
+            open.pop_back();
+            uint64_t entries = profile.executed[start];
+            if (entries)
+                loops.push_back({start, entries, entries - profile.work[start] + profile.work[pc]});
+        }
+    }
+    std::sort(loops.begin(), loops.end(), [](const LoopRow& a, const LoopRow& b) { return a.iterations > b.iterations; });
+    os << "Hottest loops (source position of `[`):\n"
+          "  source   bytecode          entries       iterations   per entry  body\n";
+    for (size_t r = 0; r < std::min(top, loops.size()); ++r) {
+        const LoopRow& loop = loops[r];
+        size_t end = size_t(code[loop.start].value);
+        snprintf(line, sizeof(line), "  %-8d %-8zu %16llu %16llu %11.1f  %zu instructions\n", code[loop.start].offset,
+                 loop.start, static_cast<unsigned long long>(loop.entries),
+                 static_cast<unsigned long long>(loop.iterations), double(loop.iterations) / double(loop.entries),
+                 end - loop.start - 1);
+        os << line;
+    }
+
+    std::vector<size_t> collapsed;
+    for (size_t pc = 0; pc < code.size(); ++pc)
+        if ((code[pc].op == SCAN || code[pc].op == SET_ZERO || code[pc].op == CLEAR_RANGE ||
+             code[pc].op == MUL_CLEAR) && profile.work[pc])
+            collapsed.push_back(pc);
+    std::sort(collapsed.begin(), collapsed.end(),
+              [&](size_t a, size_t b) { return profile.work[a] > profile.work[b]; });
+    os << "Hottest collapsed loops (iterations the original loops would have run):\n"
+          "  bytecode       executions       iterations  in loop at  instruction\n";
+    for (size_t r = 0; r < std::min(top, collapsed.size()); ++r) {
+        size_t pc = collapsed[r];
+        std::string where = enclosing[pc] == SIZE_MAX ? "top level" : std::to_string(code[enclosing[pc]].offset);
+        bool multiply = code[pc].op == MUL_CLEAR || (code[pc].op == SET_ZERO && pc > 0 && code[pc - 1].op == MUL_ADD);
+        snprintf(line, sizeof(line), "  %-8zu %16llu %16llu  %-10s  ", pc,
+                 static_cast<unsigned long long>(profile.executed[pc]),
+                 static_cast<unsigned long long>(profile.work[pc]), where.c_str());
+        os << line;
+        print_instruction(os, code[pc]);
+        os << (multiply ? " (multiply loop)\n" : "\n");
+    }
+
+    // Candidates for super-instructions: the pairs that cost the most dispatches
+    struct PairRow {
+        unsigned first, second;
+        uint64_t count;
+    };
+    std::vector<PairRow> pairs;
+    for (unsigned a = 0; a < bytecode_count; ++a)
+        for (unsigned b = 0; b < bytecode_count; ++b)
+            if (profile.pairs[a][b])
+                pairs.push_back({a, b, profile.pairs[a][b]});
+    std::sort(pairs.begin(), pairs.end(), [](const PairRow& a, const PairRow& b) { return a.count > b.count; });
+    os << "Most frequent opcode pairs (dynamic):\n";
+    for (size_t r = 0; r < std::min(top, pairs.size()); ++r) {
+        snprintf(line, sizeof(line), "  %-16s %-16s %16llu %6.2f%%\n", bytecode_names[pairs[r].first],
+                 bytecode_names[pairs[r].second], static_cast<unsigned long long>(pairs[r].count),
+                 100.0 * double(pairs[r].count) / double(total));
+        os << line;
+    }
+}
+
+// `--stats=json`: the counters of one run as a single JSON object; counters the engine cannot
+// provide (dispatches and loop iterations of JIT code) are null
+void print_stats(std::ostream& os, const Stats& stats, const char* engine, int cell_bits, size_t code_size) {
+    auto counter = [&os](const char* name, uint64_t value) {
+        os << ", \"" << name << "\": ";
+        if (value == Stats::unknown)
+            os << "null";
+        else
+            os << value;
+    };
+    std::ios::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(1) << "{\"engine\": \"" << engine << "\", \"cell_bits\": " << cell_bits
+       << ", \"bytecode_instructions\": " << code_size;
+    counter("instructions", stats.instructions);
+    counter("loop_iterations", stats.loop_iterations);
+    counter("tape_pages", stats.tape_pages);
+    counter("tape_high_water", stats.tape_high_water);
+    counter("bytes_in", stats.bytes_in);
+    counter("bytes_out", stats.bytes_out);
+    os << ", \"compile_us\": " << stats.compile_seconds * 1e6 << ", \"optimize_us\": " << stats.optimize_seconds * 1e6
+       << ", \"execute_us\": " << stats.execute_seconds * 1e6 << "}\n";
+    os.flags(flags);
+}
+
+// Runtime of the C files written by `--emit-c`: the same guarded tape layout as `Tape`, buffered
+// write(2)/read(2) I/O like `Output`/`Input`, and SCAN with memchr/memrchr. Preceded by the
+// definitions of `cell`, EOF_MODE, REACH and TAPE_BYTES; followed by the program in main().
+static const char c_runtime[] = R"(#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static unsigned char out_buf[1 << 16], in_buf[1 << 16];
+static size_t out_len, in_pos, in_len;
+static int line_buffered, in_eof;
+static unsigned char* mapping;
+static size_t mapping_length;
+static cell *tape_begin, *tape_end;
+
+static void flush_out(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out_buf + done, out_len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    out_len = 0;
+}
+
+static void fail(const char* message) {
+    flush_out();
+    ssize_t written = write(STDERR_FILENO, message, strlen(message));
+    (void)written;
+    _exit(1);
+}
+
+__attribute__((unused)) static void put(cell c, int count) {
+    while (count-- > 0) {
+        out_buf[out_len++] = (unsigned char)c;
+        if (out_len == sizeof(out_buf))
+            flush_out();
+    }
+    if (line_buffered && (unsigned char)c == '\n')
+        flush_out();
+}
+
+__attribute__((unused)) static void get(cell* p, int count) {
+    for (; count > 0; --count) {
+        if (in_pos == in_len) {
+            ssize_t n = 0;
+            if (!in_eof) {
+                flush_out();
+                do
+                    n = read(STDIN_FILENO, in_buf, sizeof(in_buf));
+                while (n < 0 && errno == EINTR);
+            }
+            if (n <= 0) {
+                in_eof = 1;
+                if (EOF_MODE == 1)
+                    *p = 0;
+                else if (EOF_MODE == 2)
+                    *p = (cell)-1;
+                else
+                    (void)*(volatile cell*)p;
+                continue;
+            }
+            in_pos = 0;
+            in_len = (size_t)n;
+        }
+        *p = in_buf[in_pos++];
+    }
+}
+
+__attribute__((unused)) static cell* scan(cell* p, int stride) {
+    if (sizeof(cell) == 1 && stride == 1) {
+        p = memchr(p, 0, (size_t)(tape_end - p));
+    } else if (sizeof(cell) == 1 && stride == -1) {
+        p = memrchr(tape_begin, 0, (size_t)(p - tape_begin) + 1);
+    } else {
+        while (p >= tape_begin && p < tape_end && *p)
+            p += stride;
+        if (p < tape_begin || p >= tape_end)
+            p = NULL;
+    }
+    if (!p)
+        fail("Error: pointer scan ran past the end of the tape\n");
+    return p;
+}
+
+/* See mul_runs() in brainfuck.cpp: a folded loop that never runs must not touch targets off the tape */
+__attribute__((unused)) static int mul_runs(cell* target, cell factor) {
+    return (uintptr_t)target - (uintptr_t)tape_begin < (uintptr_t)tape_end - (uintptr_t)tape_begin || factor != 0;
+}
+
+static void on_fault(int sig, siginfo_t* info, void* context) {
+    unsigned char* address = info->si_addr;
+    (void)context;
+    if (address >= mapping && address < mapping + mapping_length)
+        fail("Error: pointer moved off the tape\n");
+    signal(sig, SIG_DFL);
+}
+
+int main(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t guard = (REACH * sizeof(cell) / page + 1) * page;
+    mapping_length = guard + TAPE_BYTES + guard;
+    mapping = mmap(NULL, mapping_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED || mprotect(mapping + guard, TAPE_BYTES, PROT_READ | PROT_WRITE) != 0)
+        fail("Error: Cannot allocate the tape\n");
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    tape_begin = (cell*)(mapping + guard);
+    tape_end = (cell*)(mapping + guard + TAPE_BYTES);
+    line_buffered = isatty(STDOUT_FILENO);
+    cell* p = tape_begin;
+)";
+
+// `--emit-c`: writes the optimized bytecode as a self-contained C program (C11 with GNU extensions,
+// e.g. `cc -O3 -std=gnu11`) that behaves like the interpreters with the given cell width and EOF
+// mode. Loops become `while` loops, so the C compiler allocates registers and vectorizes across
+// instructions, which none of the engines do.
+void emit_c(std::ostream& os, std::span<const Instruction> code, int cell_bits, EofMode eof_mode) {
+    os << "/* Generated by brainfuck --emit-c */\n"
+          "#define _GNU_SOURCE\n"
+          "#include <stdint.h>\n"
+          "#include <stddef.h>\n\n"
+          "typedef uint" << cell_bits << "_t cell;\n"
+          "#define EOF_MODE " << int(eof_mode) << "  /* 0: unchanged, 1: zero, 2: all ones */\n"
+          "#define REACH " << tape_reach(code) << "u\n"
+          "#define TAPE_BYTES ((size_t)" << Tape::size << "u)\n\n"
+       << c_runtime;
+
+    // Values are printed as unsigned constants, so every addition wraps at the cell width
+    auto constant = [](int value) { return std::to_string(uint32_t(value)) + "u"; };
+    auto at = [](int offset) { return "p[" + std::to_string(offset) + "]"; };
+    int depth = 1;
+    for (const Instruction& instr : code) {
+        if (instr.op == CHECK)
+            continue;  // the C runtime relies on guard pages too
+        if (instr.op == SHIFT_LOOP_END)
+            os << std::string(4 * size_t(depth), ' ') << "p += " << instr.source << ";\n";
+        if (closes_loop(instr.op))
+            --depth;
+        os << std::string(4 * size_t(depth), ' ');
+        switch (instr.op) {
+            case INC_PTR: os << "p += " << instr.value << ";\n"; break;
+            case DEC_PTR: os << "p -= " << instr.value << ";\n"; break;
+            case INC_VAL: os << at(instr.offset) << " += " << constant(instr.value) << ";\n"; break;
+            case DEC_VAL: os << at(instr.offset) << " -= " << constant(instr.value) << ";\n"; break;
+            case OUTPUT: os << "put(" << at(instr.offset) << ", " << instr.value << ");\n"; break;
+            case INPUT: os << "get(&" << at(instr.offset) << ", " << instr.value << ");\n"; break;
+            case SET_ZERO: os << at(instr.offset) << " = 0;\n"; break;
+            case CLEAR_RANGE:
+                os << "memset(&" << at(instr.offset) << ", 0, " << instr.value << " * sizeof(cell));\n";
+                break;
+            case MUL_ADD: case MUL_CLEAR:
+                os << "if (mul_runs(&" << at(instr.offset) << ", " << at(instr.source) << ")) " << at(instr.offset)
+                   << " += (cell)(" << constant(instr.value) << " * " << at(instr.source) << ");\n";
+                if (instr.op == MUL_CLEAR)
+                    os << std::string(4 * size_t(depth), ' ') << at(instr.source) << " = 0;\n";
+                break;
+            case VEC_ADD:
+                os << "for (int k = 0; k < " << instr.source << "; ++k) p[" << instr.offset << " + k] += "
+                   << constant(instr.value) << ";\n";
+                break;
+            case SCAN: os << "p = scan(p, " << instr.value << ");\n"; break;
+            case LOOP_START:
+                os << "while (*p) {\n";
+                ++depth;
+                break;
+            case LOOP_END: case SHIFT_LOOP_END: os << "}\n"; break;
+            case TRAP:
+                os << "if (" << (instr.value == '[' ? "!*p" : "*p") << ") fail(\"Error: Unmatched '"
+                   << char(instr.value) << "' at position " << instr.offset << "\\n\");\n";
+                break;
+            case CHECK:
+                break;
+        }
+    }
+    os << "    flush_out();\n"
+          "    return 0;\n"
+          "}\n";
+}
+
+enum Engine {
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_JIT,
+    ENGINE_TIERED,
+};
+static const char* const engine_names[] = {"switch", "threaded", "jit", "tiered"};
+
+// Runs `program` on `tape` with the interpreter instantiation for `Cell` and `Mode`
+template <class Cell, unsigned Mode>
+void run_engine(Engine engine, std::span<const Instruction> program, IO& io, Tape& tape, Profile* profile,
+                Stats* stats) {
+    if constexpr ((Mode & PROFILED) != 0) {
+        interpret_bytecode<Cell, Mode>(program, io, tape, profile);
+        return;
+    }
+    switch (engine) {
+#if BF_HAVE_THREADED
+        case ENGINE_THREADED: interpret_threaded<Cell, Mode>(program, io, tape, stats); break;
+#endif
+#if BF_HAVE_JIT
+        case ENGINE_JIT: interpret_jit(program, io, tape); break;
+#endif
+        default: interpret_bytecode<Cell, Mode>(program, io, tape, profile, stats); break;
+    }
+}
+
+// Runs `program` on `tape` with an interpreter instantiated for `Cell`; the JIT only emits 8-bit
+// cell code. Profiling always uses the switch interpreter. With `stats` the interpreters run their
+// COUNTED instantiations, and a profile provides the same counts; with a watchdog in `io` the
+// WATCHED ones.
+template <class Cell>
+void execute(Engine engine, std::span<const Instruction> program, IO& io, Tape& tape, Profile* profile,
+             Stats* stats = nullptr) {
+    unsigned mode = (profile ? unsigned(PROFILED) : stats ? unsigned(COUNTED) : 0u) | (io.watchdog ? unsigned(WATCHED) : 0u);
+    switch (mode) {
+        case 0: run_engine<Cell, 0>(engine, program, io, tape, profile, stats); break;
+        case COUNTED: run_engine<Cell, COUNTED>(engine, program, io, tape, profile, stats); break;
+        case WATCHED: run_engine<Cell, WATCHED>(engine, program, io, tape, profile, stats); break;
+        case COUNTED | WATCHED: run_engine<Cell, COUNTED | WATCHED>(engine, program, io, tape, profile, stats); break;
+        case PROFILED: run_engine<Cell, PROFILED>(engine, program, io, tape, profile, stats); break;
+        case PROFILED | WATCHED: run_engine<Cell, PROFILED | WATCHED>(engine, program, io, tape, profile, stats); break;
+    }
+    if (profile && stats) {
+        stats->instructions = stats->loop_iterations = 0;
+        for (size_t pc = 0; pc < program.size(); ++pc) {
+            stats->instructions += profile->executed[pc];
+            if (closes_loop(program[pc].op))
+                stats->loop_iterations += profile->work[pc];
+        }
+    }
+}
+
+// Same on a tape of its own
+template <class Cell>
+void execute(Engine engine, std::span<const Instruction> program, IO& io, Profile* profile, Stats* stats = nullptr) {
+    Tape tape(program, &io.out, sizeof(Cell));
+    execute<Cell>(engine, program, io, tape, profile, stats);
+    if (stats)
+        tape.usage(sizeof(Cell), stats->tape_pages, stats->tape_high_water);
+}
+
+// Applies `--pass=` lists to `pass_manager`; returns the first unknown pass name, or "" if all are known
+std::string apply_pass_args(PassManager& pass_manager, const std::vector<std::string>& pass_args) {
+    for (const std::string& list : pass_args) {
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = std::min(list.find(',', start), list.size());
+            std::string name = list.substr(start, end - start);
+            if (!pass_manager.set_pass(name))
+                return name.empty() ? "(empty)" : name;
+            start = end + 1;
+        }
+    }
+    return "";
+}
+
+// Library API. Build with -DBF_NO_MAIN and include this file in one translation unit.
+// A Program is compiled once and never changes, so any number of VMs on any threads can share it.
+// A VM owns a tape that is allocated once and reused by every run; errors are return values.
+// Runs off the tape are caught by a process-wide SIGSEGV handler, unless the program is `checked`.
+//
+//     std::string error, output;
+//     std::unique_ptr<Program> program = Program::compile(source, error);
+//     VM vm(*program);
+//     if (vm.run(input, output) != RUN_OK) ...
+//     vm.reset();  // before the next independent run
+struct ProgramOptions {
+    int opt_level = 2;
+    int cell_bits = 8;
+    Engine engine = BF_HAVE_THREADED ? ENGINE_THREADED : ENGINE_SWITCH;  // not ENGINE_TIERED
+    uint64_t max_iterations = 0;  // Watchdog limits of every run, 0 = none; with either one set, runs
+    double timeout = 0;           // also stop as soon as they enter a loop that never ends
+    bool checked = false;         // range checks instead of a SIGSEGV handler (not with ENGINE_JIT)
+    std::vector<std::string> pass_args;  // `--pass=` lists applied on top of opt_level
+};
+
+class Program {
+public:
+    // Compiles and optimizes `source`; returns null and describes the problem in `error` if the
+    // options are invalid. Unmatched brackets are not an error until a run takes their jump.
+    static std::unique_ptr<Program> compile(std::string_view source, std::string& error,
+                                            const ProgramOptions& options = {}) {
+        if (!valid_cell_bits(options.cell_bits)) {
+            error = "cell width must be 8, 16 or 32 bits";
+            return nullptr;
+        }
+        if (options.engine == ENGINE_TIERED || (options.engine == ENGINE_JIT && !BF_HAVE_JIT) ||
+            (options.engine == ENGINE_THREADED && !BF_HAVE_THREADED)) {
+            error = "engine not available";
+            return nullptr;
+        }
+        if (options.engine == ENGINE_JIT && options.cell_bits != 8) {
+            error = "the JIT supports 8-bit cells only";
+            return nullptr;
+        }
+        if (options.engine == ENGINE_JIT && options.checked) {
+            error = "the JIT relies on the SIGSEGV handler and cannot run checked programs";
+            return nullptr;
+        }
+        PassManager pass_manager(options.opt_level, options.cell_bits);
+        std::string unknown_pass = apply_pass_args(pass_manager, options.pass_args);
+        if (!unknown_pass.empty()) {
+            error = "unknown pass " + unknown_pass;
+            return nullptr;
+        }
+        Compiler compiler;
+        compiler.feed(source.data(), source.size());
+        std::unique_ptr<Program> program(new Program(options));
+        program->bytecode = compiler.finish();
+        pass_manager.run(program->bytecode);
+        bool watched = program->watchdog().enabled();
+        if (watched)
+            trap_endless_loops(program->bytecode);
+        if (options.checked)
+            insert_range_checks(program->bytecode);
+#if BF_HAVE_JIT
+        if (options.engine == ENGINE_JIT)
+            program->jit = std::make_unique<JitFunction>(program->bytecode, watched);
+#endif
+        return program;
+    }
+
+    std::span<const Instruction> code() const { return bytecode; }
+    const ProgramOptions& options() const { return settings; }
+
+    // An unarmed watchdog with the limits of the options
+    Watchdog watchdog() const {
+        Watchdog watchdog;
+        watchdog.max_iterations = settings.max_iterations;
+        watchdog.timeout = settings.timeout;
+        return watchdog;
+    }
+
+private:
+    explicit Program(const ProgramOptions& options) : settings(options) {}
+
+    friend class VM;
+
+    ProgramOptions settings;
+    std::vector<Instruction> bytecode;
+#if BF_HAVE_JIT
+    std::unique_ptr<JitFunction> jit;
+#endif
+};
+
+class VM {
+public:
+    explicit VM(const Program& program, EofMode eof_mode = EOF_MAX)
+        : program(program), eof_mode(eof_mode),
+          tape(program.code(), nullptr, size_t(program.options().cell_bits / 8), !program.options().checked) {
+        tape.leave();
+    }
+
+    // Runs the program from its start with the pointer on cell 0 of the current tape. Input comes
+    // from `input` (then end of input), output goes to `output` as it is flushed.
+    RunResult run(InputSource input, OutputSink output) {
+        IO io(std::move(input), std::move(output), eof_mode);
+        Watchdog watchdog = program.watchdog();
+        if (watchdog.enabled()) {
+            watchdog.arm();
+            io.watchdog = &watchdog;
+        }
+        // A run-time error jumps back here past the frames of the engine without running their
+        // destructors, so nothing it calls may own memory: the engines keep their state on the tape,
+        // in `io`, in the program (its JIT code) or in a thread-local buffer that the next run reuses
+        // (the threaded code). An error return therefore leaks nothing, however often it happens.
+        // interpret_jit() and interpret_tiered() allocate, which is why a VM cannot run them.
+        sigjmp_buf recovery;
+        RunResult result = RUN_OK;
+        tape.enter();
+        tape.set_recovery_point(&recovery);
+        if (int error = sigsetjmp(recovery, 1))
+            result = RunResult(error);
+        else
+            execute_program(io);
+        tape.set_recovery_point(nullptr);
+        tape.leave();
+        io.out.flush();
+        return result;
+    }
+
+    // Same with the input in memory and the output appended to a string
+    RunResult run(std::span<const unsigned char> input, std::string& output) {
+        size_t position = 0;
+        return run([&](unsigned char* data, size_t size) {
+            size_t n = std::min(size, input.size() - position);
+            std::memcpy(data, input.data() + position, n);
+            position += n;
+            return n;
+        }, [&](const unsigned char* data, size_t size) {
+            output.append(reinterpret_cast<const char*>(data), size);
+        });
+    }
+    RunResult run(std::string_view input, std::string& output) {
+        return run(std::span<const unsigned char>(reinterpret_cast<const unsigned char*>(input.data()), input.size()), output);
+    }
+
+    // Sets every cell back to zero, keeping the tape's mapping
+    void reset() { tape.clear(); }
+
+    // The cells as the last run left them, starting at cell 0
+    template <class Cell = unsigned char>
+    const Cell* cells() const { return tape.begin<Cell>(); }
+
+private:
+    void execute_program(IO& io) {
+#if BF_HAVE_JIT
+        if (program.jit) {
+            run_jit(*program.jit, io, tape);
+            return;
+        }
+#endif
+        int cell_bits = program.options().cell_bits;
+        if (cell_bits == 16)
+            execute<uint16_t>(program.options().engine, program.code(), io, tape, nullptr);
+        else if (cell_bits == 32)
+            execute<uint32_t>(program.options().engine, program.code(), io, tape, nullptr);
+        else
+            execute<uint8_t>(program.options().engine, program.code(), io, tape, nullptr);
+    }
+
+    const Program& program;
+    EofMode eof_mode;
+    Tape tape;
+};
+
+struct BenchOptions {
+    std::vector<std::string> files;
+    std::vector<std::string> pass_args;  // applied on top of every -O level
+    int cell_bits = 8;
+    EofMode eof_mode = EOF_MAX;
+    int repeat = 5;
+    uint32_t tier_threshold = 1000;
+    bool json = false;
+    std::string input_file = "/dev/null";  // reopened for every execution
+};
+
+// Wall-clock samples of one phase, in seconds
+struct BenchTiming {
+    std::vector<double> samples;
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = size_t(std::max(1.0, std::ceil(p * double(sorted.size()))));
+        return sorted[rank - 1];
+    }
+    double median() const { return percentile(0.5); }
+};
+
+template <class F>
+static double seconds(F&& run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// `--bench`: runs every program at every -O level on every engine `repeat` times and reports the
+// median and 95th percentile of the read, compile, optimize and execute phases as CSV or JSON, which
+// shows where the optimizer time pays for itself. Program output goes to /dev/null. The tiered engine
+// optimizes with the -O1 passes only (or none at -O0) and spends the rest of the level inside its
+// execute phase, on the loops that get hot.
+int run_bench(const BenchOptions& options) {
+    std::vector<std::pair<Engine, const char*>> engines = {{ENGINE_SWITCH, "switch"}};
+    if (BF_HAVE_THREADED)
+        engines.push_back({ENGINE_THREADED, "threaded"});
+    if (BF_HAVE_JIT && options.cell_bits == 8) {
+        engines.push_back({ENGINE_JIT, "jit"});
+        engines.push_back({ENGINE_TIERED, "tiered"});
+    }
+    bool tiered = engines.back().first == ENGINE_TIERED;
+
+    int null_out = open("/dev/null", O_WRONLY);
+    if (null_out < 0) {
+        std::cerr << "Error: Cannot open /dev/null" << std::endl;
+        return 1;
+    }
+
+    const char* phases[] = {"read", "compile", "optimize", "execute"};
+    bool first_row = true;
+    std::cout << std::fixed << std::setprecision(1);
+    if (options.json)
+        std::cout << "[";
+    else
+        std::cout << "program,level,engine,instructions,repeat,read_median_us,read_p95_us,compile_median_us,"
+                     "compile_p95_us,optimize_median_us,optimize_p95_us,execute_median_us,execute_p95_us,"
+                     "total_median_us\n";
+
+    for (const std::string& file : options.files) {
+        // Pipes and stdin can only be read once; their single read is the only read sample
+        struct stat st;
+        bool rereadable = file != "-" && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+        std::string source;
+        BenchTiming first_read;
+        first_read.samples.push_back(seconds([&] { source = read_program(file); }));
+
+        for (int level = 0; level <= 3; ++level) {
+            BenchTiming front[3];  // read, compile, optimize: the same for every engine
+            if (!rereadable)
+                front[0] = first_read;
+            BenchTiming startup_optimize;  // the tiered engine's passes before it starts
+            std::vector<Instruction> bytecode, startup;
+            for (int r = 0; r < options.repeat; ++r) {
+                if (rereadable)
+                    front[0].samples.push_back(seconds([&] { source = read_program(file); }));
+                front[1].samples.push_back(seconds([&] { bytecode = compile_to_bytecode(source); }));
+                if (tiered) {
+                    startup = bytecode;
+                    PassManager startup_passes(std::min(level, 1), options.cell_bits);
+                    startup_optimize.samples.push_back(seconds([&] { startup_passes.run(startup); }));
+                }
+                PassManager pass_manager(level, options.cell_bits);
+                apply_pass_args(pass_manager, options.pass_args);  // validated by main
+                front[2].samples.push_back(seconds([&] { pass_manager.run(bytecode); }));
+            }
+            PassManager tier_passes(level, options.cell_bits);
+            apply_pass_args(tier_passes, options.pass_args);
+
+            for (const auto& [engine, engine_name] : engines) {
+                BenchTiming execute;
+                for (int r = 0; r < options.repeat; ++r) {
+                    int in = open(options.input_file.c_str(), O_RDONLY);
+                    if (in < 0) {
+                        std::cerr << "Error: Cannot open " << options.input_file << std::endl;
+                        return 1;
+                    }
+                    execute.samples.push_back(seconds([&] {
+                        IO io(in, null_out, options.eof_mode);
+#if BF_HAVE_JIT
+                        if (engine == ENGINE_TIERED)
+                            interpret_tiered(startup, io, tier_passes, options.tier_threshold);
+                        else
+#endif
+                        if (options.cell_bits == 16)
+                            ::execute<uint16_t>(engine, bytecode, io, nullptr);
+                        else if (options.cell_bits == 32)
+                            ::execute<uint32_t>(engine, bytecode, io, nullptr);
+                        else
+                            ::execute<uint8_t>(engine, bytecode, io, nullptr);
+                    }));
+                    close(in);
+                }
+
+                bool starts_tiered = engine == ENGINE_TIERED;
+                const BenchTiming* timings[] = {&front[0], &front[1], starts_tiered ? &startup_optimize : &front[2],
+                                                &execute};
+                size_t instructions = starts_tiered ? startup.size() : bytecode.size();
+                double total = 0;
+                for (const BenchTiming* timing : timings)
+                    total += timing->median();
+                if (options.json) {
+                    std::cout << (first_row ? "\n" : ",\n") << "  {\"program\": \"";
+                    for (char c : file) {
+                        if (c == '"' || c == '\\')
+                            std::cout << '\\';
+                        std::cout << c;
+                    }
+                    std::cout << "\", \"level\": " << level << ", \"engine\": \"" << engine_name
+                              << "\", \"instructions\": " << instructions << ", \"repeat\": " << options.repeat;
+                    for (size_t phase = 0; phase < 4; ++phase)
+                        std::cout << ", \"" << phases[phase] << "\": {\"median_us\": " << timings[phase]->median() * 1e6
+                                  << ", \"p95_us\": " << timings[phase]->percentile(0.95) * 1e6 << "}";
+                    std::cout << ", \"total_median_us\": " << total * 1e6 << "}";
+                } else {
+                    std::cout << file << "," << level << "," << engine_name << "," << instructions << ","
+                              << options.repeat;
+                    for (const BenchTiming* timing : timings)
+                        std::cout << "," << timing->median() * 1e6 << "," << timing->percentile(0.95) * 1e6;
+                    std::cout << "," << total * 1e6 << "\n";
+                }
+                std::cout.flush();
+                first_row = false;
+            }
+        }
+    }
+    if (options.json)
+        std::cout << "\n]\n";
+    close(null_out);
+    return 0;
+}
+
+struct BatchOptions {
+    std::vector<std::string> inputs;
+    Engine engine = ENGINE_SWITCH;
+    int cell_bits = 8;
+    EofMode eof_mode = EOF_MAX;
+    unsigned jobs = 0;          // worker threads, 0 = one per core
+    std::string output_dir;     // empty: concatenate the outputs on stdout in input order
+    const PassManager* tier_passes = nullptr;  // for ENGINE_TIERED
+    uint32_t tier_threshold = 1000;
+    Watchdog limits;  // armed again for every job
+};
+
+// `--batch`: runs the compiled program once per input file on a pool of worker threads. The bytecode
+// (and the JIT code) is shared read-only; every job gets its own tape and I/O buffers. Workers take
+// the next job from a shared counter, so long and short inputs balance without a static split.
+// Outputs go either to output_dir/<input name>.out or, in input order, to stdout: the job at the head
+// of the order writes its output itself, the others collect theirs until every job before them is
+// done. A job that runs off the tape or exceeds a watchdog limit jumps back to its own recovery point
+// and is reported by input; the others carry on, and the batch fails at the end.
+int run_batch(std::span<const Instruction> program, const BatchOptions& options) {
+    size_t count = options.inputs.size();
+    std::vector<std::string> names(count);  // of the output files
+    if (!options.output_dir.empty()) {
+        std::unordered_map<std::string, size_t> taken;
+        for (size_t job = 0; job < count; ++job) {
+            const std::string& input = options.inputs[job];
+            names[job] = options.output_dir + "/" + input.substr(input.rfind('/') + 1) + ".out";
+            auto [other, inserted] = taken.emplace(names[job], job);
+            if (!inserted) {
+                std::cerr << "Error: " << options.inputs[other->second] << " and " << input << " would both write "
+                          << names[job] << std::endl;
+                return 1;
+            }
+        }
+    }
+    std::vector<std::string> pending(count);  // output of the jobs behind the head of the order
+    std::vector<char> done(count, 0);
+    size_t head = 0;
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::atomic<size_t> next{0};
+
+#if BF_HAVE_JIT
+    std::unique_ptr<JitFunction> jit(options.engine == ENGINE_JIT ? new JitFunction(program, options.limits.enabled())
+                                                                   : nullptr);
+#endif
+    auto run = [&](IO& io) {
+        Watchdog watchdog = options.limits;
+        if (watchdog.enabled()) {
+            watchdog.arm();
+            io.watchdog = &watchdog;
+        }
+        uint64_t reach = tape_reach(program);
+#if BF_HAVE_JIT
+        if (options.engine == ENGINE_TIERED)
+            reach = tiered_reach(program);
+#endif
+        Tape tape(reach, &io.out, size_t(options.cell_bits / 8));
+#if BF_HAVE_JIT
+        TieredState tiered;
+#endif
+        sigjmp_buf recovery;
+        tape.set_recovery_point(&recovery);
+        if (int error = sigsetjmp(recovery, 1))
+            return RunResult(error);
+#if BF_HAVE_JIT
+        if (jit)
+            run_jit(*jit, io, tape);
+        else if (options.engine == ENGINE_TIERED)
+            interpret_tiered(program, io, tape, *options.tier_passes, options.tier_threshold, tiered);
+        else
+#endif
+        if (options.cell_bits == 16)
+            execute<uint16_t>(options.engine, program, io, tape, nullptr);
+        else if (options.cell_bits == 32)
+            execute<uint32_t>(options.engine, program, io, tape, nullptr);
+        else
+            execute<uint8_t>(options.engine, program, io, tape, nullptr);
+        return RUN_OK;
+    };
+
+    auto worker = [&] {
+        for (size_t job; (job = next.fetch_add(1)) < count;) {
+            const std::string& input = options.inputs[job];
+            RunResult result = RUN_OK;
+            int in = open(input.c_str(), O_RDONLY);
+            if (in < 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cerr << "Error: Cannot open file " << input << std::endl;
+                failed = true;
+            } else if (options.output_dir.empty()) {
+                IO io(in, [&, job](const unsigned char* data, size_t size) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (job != head) {
+                        pending[job].append(reinterpret_cast<const char*>(data), size);
+                        return;
+                    }
+                    lock.unlock();
+                    write_all(STDOUT_FILENO, data, size);
+                }, options.eof_mode);
+                result = run(io);
+            } else {
+                int out = open(names[job].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (out < 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cerr << "Error: Cannot write " << names[job] << std::endl;
+                    failed = true;
+                } else {
+                    IO io(in, out, options.eof_mode);
+                    result = run(io);
+                }
+                if (out >= 0)
+                    close(out);
+            }
+            if (in >= 0)
+                close(in);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (result != RUN_OK) {
+                std::cerr << "Error: " << input << ": " << describe(result) << std::endl;
+                failed = true;
+            }
+            done[job] = 1;
+            finished.notify_one();
+        }
+    };
+
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(jobs, count); ++t)
+        workers.emplace_back(worker);
+
+    // A job becomes the head once what it collected so far is written; from then on it writes to
+    // stdout itself, and the main thread waits for it to finish. IO flushes its buffer when the job's
+    // IO object goes out of scope, before done[job] is set.
+    for (size_t job = 0; job < count; ++job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!pending[job].empty()) {
+            std::string output;
+            output.swap(pending[job]);
+            lock.unlock();
+            write_all(STDOUT_FILENO, output.data(), output.size());
+            lock.lock();
+        }
+        head = job;
+        finished.wait(lock, [&] { return done[job] != 0; });
+    }
+    for (std::thread& thread : workers)
+        thread.join();
+    return failed ? 1 : 0;
+}
+
+// One generated test for `--fuzz`: a program, its input and the machine it runs on
+struct FuzzCase {
+    std::string source;
+    std::string input;
+    int cell_bits = 8;
+    EofMode eof_mode = EOF_MAX;
+};
+
+// What a run of a FuzzCase left behind. The cells are only compared for runs that end normally:
+// after an error only the output so far is observable.
+struct FuzzResult {
+    RunResult result = RUN_OK;
+    std::string output;
+    std::vector<uint32_t> cells;  // from cell 0
+
+    bool operator==(const FuzzResult&) const = default;
+};
+
+// The reference semantics of a FuzzCase, straight from the source with no bytecode involved. The
+// pointer may pass left of cell 0, but a command that touches a cell there ends the run off the tape.
+// Returns nothing for runs that take more than `max_iterations` back-edges, which the engines may
+// legitimately cut off at different points: the optimized programs count fewer.
+static std::optional<FuzzResult> fuzz_reference(const FuzzCase& test, uint64_t max_iterations) {
+    const std::string& source = test.source;
+    std::vector<size_t> match(source.size(), SIZE_MAX);
+    std::vector<size_t> open;
+    for (size_t pc = 0; pc < source.size(); ++pc) {
+        if (source[pc] == '[') {
+            open.push_back(pc);
+        } else if (source[pc] == ']' && !open.empty()) {
+            match[pc] = open.back();
+            match[open.back()] = pc;
+            open.pop_back();
+        }
+    }
+    uint32_t mask = uint32_t(~0ull >> (64 - test.cell_bits));
+    FuzzResult result;
+    std::vector<uint32_t>& tape = result.cells;
+    tape.assign(1, 0);
+    int64_t ptr = 0;
+    size_t input = 0;
+    uint64_t back_edges = 0;
+    for (size_t pc = 0; pc < source.size(); ++pc) {
+        if (ptr < 0 && std::string_view("+-.,[]").find(source[pc]) != std::string_view::npos) {
+            result.result = RUN_OFF_TAPE;
+            tape.clear();
+            return result;
+        }
+        switch (source[pc]) {
+            case '>':
+                if (++ptr == int64_t(tape.size()))
+                    tape.push_back(0);
+                break;
+            case '<': --ptr; break;
+            case '+': tape[ptr] = (tape[ptr] + 1) & mask; break;
+            case '-': tape[ptr] = (tape[ptr] - 1) & mask; break;
+            case '.': result.output.push_back(char(tape[ptr])); break;
+            case ',':
+                if (input < test.input.size())
+                    tape[ptr] = (unsigned char)test.input[input++];
+                else if (test.eof_mode != EOF_UNCHANGED)
+                    tape[ptr] = test.eof_mode == EOF_MAX ? mask : 0;
+                break;
+            case '[':
+            case ']':
+                if ((tape[ptr] == 0) != (source[pc] == '['))
+                    break;
+                if (match[pc] == SIZE_MAX) {
+                    result.result = RUN_UNMATCHED_BRACKET;
+                    tape.clear();
+                    return result;
+                }
+                if (source[pc] == ']' && ++back_edges > max_iterations)
+                    return std::nullopt;
+                pc = match[pc];
+                break;
+        }
+    }
+    return result;
+}
+
+// Loops of the tiered engine are compiled after this many back-edges, so that the short generated
+// programs leave its interpreter
+static const uint32_t fuzz_tier_threshold = 4;
+
+// One engine and optimizer setting that every FuzzCase is run with
+struct FuzzConfig {
+    int opt_level = 0;
+    std::string passes;  // a `--pass=` list, or empty
+    Engine engine = ENGINE_SWITCH;
+    bool checked = false;
+    bool watched = false;
+
+    // The command line that runs a case with this configuration
+    std::string command(const FuzzCase& test, uint64_t max_iterations) const {
+        static const char* const eof_names[] = {"unchanged", "0", "255"};
+        std::string line = "./brainfuck -O" + std::to_string(opt_level);
+        if (!passes.empty())
+            line += " --pass=" + passes;
+        line += std::string(" --engine=") + engine_names[engine] + (checked ? " --checked" : "");
+        if (engine == ENGINE_TIERED)
+            line += " --tier-threshold=" + std::to_string(fuzz_tier_threshold);
+        if (watched)
+            line += " --max-iterations=" + std::to_string(max_iterations);
+        return line + " --cell-bits=" + std::to_string(test.cell_bits) + " --eof=" + eof_names[test.eof_mode];
+    }
+};
+
+template <class Cell>
+static void read_cells(const VM& vm, size_t count, std::vector<uint32_t>& cells) {
+    const Cell* begin = vm.cells<Cell>();
+    cells.assign(begin, begin + count);
+}
+
+#if BF_HAVE_JIT
+// Runs `startup` on the tiered engine on `tape`; returns the error a run-time error jumps back with
+static RunResult run_tiered(std::span<const Instruction> startup, IO& io, Tape& tape, const PassManager& passes,
+                            TieredState& state) {
+    sigjmp_buf recovery;
+    tape.set_recovery_point(&recovery);
+    if (int error = sigsetjmp(recovery, 1))
+        return RunResult(error);
+    interpret_tiered(startup, io, tape, passes, fuzz_tier_threshold, state);
+    tape.set_recovery_point(nullptr);
+    return RUN_OK;
+}
+
+// The tiered engine is not a ProgramOptions engine, so this builds what main builds for it: the
+// startup bytecode at -O1 at most, with `config` applied to the loops that get hot
+static FuzzResult fuzz_run_tiered(const FuzzCase& test, const FuzzConfig& config, uint64_t max_iterations,
+                                  size_t count) {
+    Compiler compiler;
+    compiler.feed(test.source.data(), test.source.size());
+    std::vector<Instruction> startup = compiler.finish();
+    PassManager(std::min(config.opt_level, 1), test.cell_bits).run(startup);
+    if (config.watched)
+        trap_endless_loops(startup);
+    PassManager passes(config.opt_level, test.cell_bits);
+    apply_pass_args(passes, {config.passes});
+    FuzzResult result;
+    size_t position = 0;
+    IO io([&](unsigned char* data, size_t size) {
+        size_t n = std::min(size, test.input.size() - position);
+        std::memcpy(data, test.input.data() + position, n);
+        position += n;
+        return n;
+    }, [&](const unsigned char* data, size_t size) {
+        result.output.append(reinterpret_cast<const char*>(data), size);
+    }, test.eof_mode);
+    Watchdog watchdog;
+    watchdog.max_iterations = config.watched ? max_iterations : 0;
+    if (watchdog.enabled()) {
+        watchdog.arm();
+        io.watchdog = &watchdog;
+    }
+    Tape tape(tiered_reach(startup), &io.out);
+    TieredState state;
+    result.result = run_tiered(startup, io, tape, passes, state);
+    io.out.flush();
+    if (result.result == RUN_OK)
+        result.cells.assign(tape.begin(), tape.begin() + count);
+    return result;
+}
+#endif
+
+// Runs `test` through the compiler, passes and engine of `config` on a fresh VM; `count` cells of
+// the tape are read back after a normal end
+static FuzzResult fuzz_run(const FuzzCase& test, const FuzzConfig& config, uint64_t max_iterations, size_t count) {
+#if BF_HAVE_JIT
+    if (config.engine == ENGINE_TIERED)
+        return fuzz_run_tiered(test, config, max_iterations, count);
+#endif
+    ProgramOptions options;
+    options.opt_level = config.opt_level;
+    options.cell_bits = test.cell_bits;
+    options.engine = config.engine;
+    options.checked = config.checked;
+    if (!config.passes.empty())
+        options.pass_args.push_back(config.passes);
+    if (config.watched)
+        options.max_iterations = max_iterations;
+    std::string error;
+    std::unique_ptr<Program> program = Program::compile(test.source, error, options);  // valid by construction
+    VM vm(*program, test.eof_mode);
+    FuzzResult result;
+    result.result = vm.run(test.input, result.output);
+    if (result.result != RUN_OK)
+        return result;
+    if (test.cell_bits == 16)
+        read_cells<uint16_t>(vm, count, result.cells);
+    else if (test.cell_bits == 32)
+        read_cells<uint32_t>(vm, count, result.cells);
+    else
+        read_cells<uint8_t>(vm, count, result.cells);
+    return result;
+}
+
+// Whether `config` disagrees with the reference on `test`; cases without a reference result never do.
+// Compares the cells the reference reached and a few beyond, which must still be zero. A program that
+// touches a cell left of cell 0 is compared with the switch engine on the same bytecode instead: the
+// passes drop accesses that change nothing (a run of `+` and `-` that cancels out, an add of a known
+// zero), so whether it runs off the tape depends on the -O level, but never on the engine. The tiered
+// engine runs its cold code at -O1 at most and its hot loops at the full level, so it has to agree
+// with the switch engine at one of the two; where either run exceeds the iteration limit, its
+// bytecode counts other back-edges and there is no verdict.
+static bool fuzz_mismatch(const FuzzCase& test, const FuzzConfig& config, uint64_t max_iterations,
+                          FuzzResult* expected = nullptr, FuzzResult* actual = nullptr) {
+    std::optional<FuzzResult> reference = fuzz_reference(test, max_iterations);
+    if (!reference)
+        return false;
+    bool off_tape = reference->result == RUN_OFF_TAPE;
+    if (off_tape) {
+        if (!config.watched)
+            return false;  // might never end; run_fuzz() watches every case that runs off the tape
+        FuzzConfig baseline = config;
+        baseline.engine = ENGINE_SWITCH;
+        baseline.checked = false;
+        reference = fuzz_run(test, baseline, max_iterations, 64);
+    } else if (reference->result == RUN_OK) {
+        reference->cells.resize(reference->cells.size() + 16, 0);
+    }
+    FuzzResult result = fuzz_run(test, config, max_iterations, reference->cells.size());
+    if (expected)
+        *expected = *reference;
+    if (actual)
+        *actual = result;
+    if (result == *reference || !off_tape || config.engine != ENGINE_TIERED)
+        return result != *reference;
+    if (result.result == RUN_LIMIT_EXCEEDED || reference->result == RUN_LIMIT_EXCEEDED)
+        return false;
+    FuzzConfig startup = config;
+    startup.engine = ENGINE_SWITCH;
+    startup.opt_level = std::min(config.opt_level, 1);
+    startup.passes.clear();
+    return fuzz_run(test, startup, max_iterations, result.cells.size()) != result;
+}
+
+// Random programs for `--fuzz`: runs of every command and the loop shapes the passes look for (clears,
+// scans, multiply loops with odd and even counter steps, offset arithmetic, nested loops), now and
+// then an unmatched bracket, and random input
+class FuzzGenerator {
+public:
+    explicit FuzzGenerator(uint64_t seed) : rng(seed) {}
+
+    FuzzCase next() {
+        FuzzCase test;
+        static const int widths[] = {8, 8, 16, 32};
+        test.cell_bits = widths[below(4)];
+        test.eof_mode = EofMode(below(3));
+        for (size_t n = below(8); n > 0; --n)
+            test.input.push_back(char(below(4) ? 'A' + below(26) : below(256)));
+        move(test.source, long(below(5)));  // without it most programs would run off the tape at once
+        block(test.source, 0, 1 + below(12));
+        if (below(8) == 0)
+            test.source.insert(below(test.source.size() + 1), 1, below(2) ? '[' : ']');
+        return test;
+    }
+
+private:
+    size_t below(size_t n) { return size_t(rng() % n); }
+
+    void repeat(std::string& out, char c, size_t n) { out.append(n, c); }
+
+    // `n` cells to the right (or left for negative n)
+    void move(std::string& out, long n) { repeat(out, n < 0 ? '<' : '>', size_t(std::abs(n))); }
+
+    void block(std::string& out, int depth, size_t items) {
+        for (size_t item = 0; item < items; ++item) {
+            switch (below(depth < 3 ? 12 : 11)) {
+                case 0: case 1: repeat(out, "+-"[below(2)], below(8) ? 1 + below(5) : 1 + below(300)); break;
+                case 2: case 3: move(out, long(below(4) + 1) * (below(3) ? 1 : -1)); break;
+                case 4: out += '.'; break;
+                case 5: out += ','; break;
+                case 6: out += below(2) ? "[-]" : below(2) ? "[+]" : "[---]"; break;
+                case 7: {
+                    out += '[';
+                    move(out, long(below(3) + 1) * (below(2) ? 1 : -1));
+                    out += ']';
+                    break;
+                }
+                case 8: case 9: {  // a multiply loop, sometimes one that does not return to its counter
+                    out += '[';
+                    repeat(out, below(4) ? '-' : '+', 1 + below(4));
+                    long at = 0;
+                    for (size_t targets = 1 + below(3); targets > 0; --targets) {
+                        long to = long(below(7)) - 3;
+                        move(out, to - at);
+                        repeat(out, "+-"[below(2)], 1 + below(6));
+                        at = to;
+                    }
+                    move(out, below(6) ? -at : -at + 1);
+                    out += ']';
+                    break;
+                }
+                case 10: out += ".>"; break;
+                case 11:
+                    out += '[';
+                    block(out, depth + 1, 1 + below(5));
+                    out += ']';
+                    break;
+            }
+        }
+    }
+
+    std::mt19937_64 rng;
+};
+
+struct FuzzOptions {
+    uint64_t count = 1000;               // programs to generate
+    uint64_t seed = 1;
+    uint64_t max_iterations = 10000;     // back-edges a reference run may take
+};
+
+// Shrinks a failing case for `config` by removing ever smaller chunks of the program, then of the
+// input, for as long as the mismatch remains
+static void minimize(FuzzCase& test, const FuzzConfig& config, uint64_t max_iterations) {
+    for (std::string* text : {&test.source, &test.input}) {
+        for (size_t chunk = std::max<size_t>(text->size() / 2, 1); chunk > 0; chunk /= 2) {
+            for (size_t start = 0; start < text->size();) {
+                FuzzCase smaller = test;
+                std::string& shrunk = text == &test.source ? smaller.source : smaller.input;
+                shrunk.erase(start, chunk);
+                if (fuzz_mismatch(smaller, config, max_iterations))
+                    test = std::move(smaller);
+                else
+                    start += chunk;
+            }
+        }
+    }
+}
+
+static void print_bytes(std::ostream& os, const std::string& bytes) {
+    os << "\"";
+    for (unsigned char c : bytes) {
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            os << c;
+        } else {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            os << escaped;
+        }
+    }
+    os << "\"";
+}
+
+static void print_fuzz_result(std::ostream& os, const char* label, const FuzzResult& result, const FuzzResult& other) {
+    os << label << "result " << result.result << ", output ";
+    print_bytes(os, result.output);
+    for (size_t cell = 0; cell < std::min(result.cells.size(), other.cells.size()); ++cell) {
+        if (result.cells[cell] != other.cells[cell]) {
+            os << ", cell " << cell << " = " << result.cells[cell];
+            break;
+        }
+    }
+    os << "\n";
+}
+
+// `--fuzz`: differential testing of the compiler, every pass and every engine. Generates `count`
+// random cases and runs each at -O0..-O3 and with a random set of passes, on every engine including
+// the tiered one, with and without range checks, and half of them (and all that run off the tape)
+// under a watchdog. Each run must agree with fuzz_reference() on the result, the output and, if it
+// ends normally, the tape; a run off the tape is judged against the switch engine (fuzz_mismatch()).
+// The first mismatch is minimized and printed with the command line that reproduces it. Every case
+// is run on fresh tapes in this process, so a miscompiled program that never ends hangs the fuzzer
+// unless it is watched.
+int run_fuzz(const FuzzOptions& options) {
+    std::vector<Engine> engines = {ENGINE_SWITCH};
+    if (BF_HAVE_THREADED)
+        engines.push_back(ENGINE_THREADED);
+    if (BF_HAVE_JIT) {
+        engines.push_back(ENGINE_JIT);
+        engines.push_back(ENGINE_TIERED);
+    }
+
+    FuzzGenerator generator(options.seed);
+    std::mt19937_64 rng(options.seed ^ 0x9e3779b97f4a7c15ull);
+    uint64_t runs = 0, off_tape = 0, skipped = 0;
+    for (uint64_t index = 0; index < options.count; ++index) {
+        FuzzCase test = generator.next();
+        std::optional<FuzzResult> reference = fuzz_reference(test, options.max_iterations);
+        if (!reference) {
+            ++skipped;
+            continue;
+        }
+        std::string random_passes;
+        for (size_t p = 0; p < pass_count; ++p)
+            if (rng() % 2)
+                random_passes += std::string(random_passes.empty() ? "" : ",") + passes[p].name;
+        // Once the passes drop the access that runs off the tape, the program may never end
+        bool watched = rng() % 2 || reference->result == RUN_OFF_TAPE;
+        off_tape += reference->result == RUN_OFF_TAPE;
+        for (int level = 0; level <= 4; ++level) {
+            for (Engine engine : engines) {
+                if ((engine == ENGINE_JIT || engine == ENGINE_TIERED) && test.cell_bits != 8)
+                    continue;
+                for (bool checked : {false, true}) {
+                    if (checked && (engine == ENGINE_JIT || engine == ENGINE_TIERED))
+                        continue;
+                    FuzzConfig config;
+                    config.opt_level = level == 4 ? 0 : level;
+                    config.passes = level == 4 ? random_passes : "";
+                    config.engine = engine;
+                    config.checked = checked;
+                    config.watched = watched;
+                    ++runs;
+                    if (!fuzz_mismatch(test, config, options.max_iterations))
+                        continue;
+                    minimize(test, config, options.max_iterations);
+                    FuzzResult expected, actual;
+                    fuzz_mismatch(test, config, options.max_iterations, &expected, &actual);
+                    std::cerr << "Mismatch in case " << index << " of seed " << options.seed << ": "
+                              << config.command(test, options.max_iterations) << "\n  program: " << test.source
+                              << "\n  input: ";
+                    print_bytes(std::cerr, test.input);
+                    std::cerr << "\n";
+                    print_fuzz_result(std::cerr, "  expected: ", expected, actual);
+                    print_fuzz_result(std::cerr, "  actual:   ", actual, expected);
+                    return 1;
+                }
+            }
+        }
+    }
+    std::cout << options.count << " cases (" << off_tape << " off the tape), " << runs << " runs agreed, " << skipped
+              << " cases skipped (over " << options.max_iterations << " loop iterations)\n";
+    return 0;
+}
+
+#ifndef BF_NO_MAIN
+// Prepares stdin and stdout for a run resumed from `header`: skips the input the checkpointed run
+// had read, and truncates a regular file appended to (`>>`) back to the output it had written, which
+// drops the output of the checkpointed run after its last checkpoint
+static void resume_streams(const CheckpointHeader& header) {
+    uint64_t skip = header.input_offset;
+    if (skip && lseek(STDIN_FILENO, off_t(skip), SEEK_CUR) < 0) {
+        char buffer[1 << 16];
+        while (skip) {
+            ssize_t n = read(STDIN_FILENO, buffer, size_t(std::min<uint64_t>(skip, sizeof(buffer))));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;  // the input ended early, so the resumed run reads none
+            skip -= uint64_t(n);
+        }
+    }
+    struct stat info;
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (flags >= 0 && (flags & O_APPEND) && fstat(STDOUT_FILENO, &info) == 0 && S_ISREG(info.st_mode) &&
+        uint64_t(info.st_size) > header.output_offset && ftruncate(STDOUT_FILENO, off_t(header.output_offset)) != 0)
+        std::cerr << "Warning: cannot truncate the output to the checkpoint" << std::endl;
+}
+
+// Main function to handle the CLI
+int main(int argc, char* argv[]) {
+    const char* usage =
+        "Usage: ./brainfuck [-c] [--engine=switch|threaded|jit|tiered] [--jit] [--tier-threshold=n]\n"
+        "                   [-O0|-O1|-O2|-O3]\n"
+        "                   [--pass=[-]name,...] [--time-passes] [--profile] [--eof=unchanged|0|255]\n"
+        "                   [--cell-bits=8|16|32] [--emit=file.bfc] [--emit-c=file.c]\n"
+        "                   [--cache=dir] [--stats[=json]] [--stats-output=file]\n"
+        "                   [--tape-size=bytes] [--checked] [--max-iterations=n] [--timeout=seconds]\n"
+        "                   [--checkpoint=file] [--checkpoint-every=n] [--resume=file] program_file\n"
+        "       ./brainfuck --bench[=csv|json] [--repeat=n] [--bench-input=file] program_file...\n"
+        "       ./brainfuck --batch [--jobs=n] [--batch-output=dir] [options] program_file input_file...\n"
+        "       ./brainfuck --fuzz[=n] [--seed=n]\n"
+        "    -c: print bytecode instead of executing\n"
+        "    --engine: execution engine (default: threaded where supported, else switch)\n"
+        "    --jit: same as --engine=jit\n"
+        "    --engine=tiered: start interpreting -O1 bytecode and compile loops that jump back\n"
+        "        --tier-threshold times (default: 1000) with the -O passes and the JIT\n"
+        "    -O: optimization level (default: -O2)\n"
+        "        -O0: no passes, -O1: run-length merge, clear and scan loops,\n"
+        "        -O2: also multiply loops, offset folding, range clears and adds, known cell values,\n"
+        "        -O3: also evaluate the program up to its first input at compile time\n"
+        "    --pass: enable (name) or disable (-name) individual passes on top of -O:\n"
+        "        merge, clear, scan, mul, offset, range-clear, vec-add, known, prefix, fuse\n"
+        "    --time-passes: print per-pass timing and instruction-count deltas to stderr\n"
+        "    --profile: run on the switch engine and print execution counts per opcode and the\n"
+        "        hottest loops (by source position) and collapsed loops to stderr\n"
+        "    --eof: value stored by `,` at end of input: unchanged, 0 or 255 (default; all ones for wider cells)\n"
+        "    --cell-bits: cell width in bits (default: 8); the JIT supports 8-bit cells only\n"
+        "    --tape-size: bytes of address space reserved for the cells, with an optional K, M or G suffix\n"
+        "        (default: 1G); only the pages a program touches use memory\n"
+        "    --checked: check the pointer range where it cannot be proven instead of relying on guard pages\n"
+        "        (switch and threaded engines)\n"
+        "    --emit: write the optimized bytecode to file.bfc instead of executing\n"
+        "    --emit-c: write the optimized program as a C source file to file.c instead of executing\n"
+        "    --cache: reuse bytecode compiled earlier with the same source and passes from dir\n"
+        "    --max-iterations: stop with an error after n loop iterations (taken back-edges)\n"
+        "    --timeout: stop with an error after the given wall-clock time of execution\n"
+        "        Either one also warns about loops that never end once entered and stops on entering one\n"
+        "    --checkpoint: write the state of the run (tape, pointer, position, I/O offsets) to file on\n"
+        "        SIGUSR1, and on SIGINT or SIGTERM before exiting (switch and threaded engines)\n"
+        "    --checkpoint-every: also write it every n loop iterations (taken back-edges)\n"
+        "    --resume: continue the run saved in file with the same program and options; skips the input\n"
+        "        it had read, and drops later output from a file appended to with >>\n"
+        "    --stats: write instructions dispatched, loop iterations, tape pages touched, bytes in/out\n"
+        "        and compile/optimize/execute times as JSON to stderr, or to file with --stats-output\n"
+        "    --bench: time reading, compiling, optimizing and executing every program at -O0..-O3\n"
+        "        on every engine and print the median and p95 per phase as CSV (default) or JSON\n"
+        "    --repeat: runs per measurement in --bench (default: 5)\n"
+        "    --bench-input: file the programs read their input from in --bench (default: /dev/null)\n"
+        "    --batch: compile once and run the program on every input file in parallel; the outputs\n"
+        "        are written to stdout in input order, or to dir/<input name>.out with --batch-output\n"
+        "    --jobs: worker threads for --batch (default: one per core)\n"
+        "    --fuzz: run n random programs (default: 1000) at every -O level and with random passes on\n"
+        "        every engine, with and without --checked, and compare their output and tape with a\n"
+        "        reference interpreter; prints the first mismatch, minimized, and exits with 1\n"
+        "    --seed: seed of the random programs for --fuzz (default: 1)\n"
+        "    program_file: file or pipe that contains the Brainfuck program, `-` for stdin,\n"
+        "        or a .bfc file written by --emit, which is mapped and run without compiling\n"
+        "        (with the cell width it was compiled for)\n";
+
+    bool print_bytecode = false;
+    bool checked = false;
+    bool time_passes = false;
+    bool profiling = false;
+    bool stats_enabled = false;
+    std::string stats_file;
+    EofMode eof_mode = EOF_MAX;
+    int opt_level = 2;
+    int cell_bits = 8;
+    std::vector<std::string> pass_args;
+    std::string emit_file;
+    std::string emit_c_file;
+    std::string cache_dir;
+    Engine engine = BF_HAVE_THREADED ? ENGINE_THREADED : ENGINE_SWITCH;
+    uint32_t tier_threshold = 1000;
+    Watchdog watchdog;
+    std::string resume_file;
+    Checkpoint checkpoint;
+    std::vector<std::string> program_files;
+    bool bench = false;
+    BenchOptions bench_options;
+    bool batch = false;
+    BatchOptions batch_options;
+    bool fuzz = false;
+    FuzzOptions fuzz_options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-c") {
+            print_bytecode = true;
+        } else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+            opt_level = arg[2] - '0';
+        } else if (arg.rfind("--pass=", 0) == 0) {
+            pass_args.push_back(arg.substr(7));
+        } else if (arg.rfind("--emit=", 0) == 0 && arg.size() > 7) {
+            emit_file = arg.substr(7);
+        } else if (arg.rfind("--emit-c=", 0) == 0 && arg.size() > 9) {
+            emit_c_file = arg.substr(9);
+        } else if (arg.rfind("--cache=", 0) == 0 && arg.size() > 8) {
+            cache_dir = arg.substr(8);
+        } else if (arg == "--checked") {
+            checked = true;
+        } else if (arg == "--time-passes") {
+            time_passes = true;
+        } else if (arg == "--profile") {
+            profiling = true;
+        } else if (arg == "--stats" || arg == "--stats=json") {
+            stats_enabled = true;
+        } else if (arg.rfind("--stats-output=", 0) == 0 && arg.size() > 15) {
+            stats_enabled = true;
+            stats_file = arg.substr(15);
+        } else if (arg == "--eof=unchanged") {
+            eof_mode = EOF_UNCHANGED;
+        } else if (arg == "--eof=0") {
+            eof_mode = EOF_ZERO;
+        } else if (arg == "--eof=255") {
+            eof_mode = EOF_MAX;
+        } else if (arg.rfind("--cell-bits=", 0) == 0) {
+            cell_bits = std::atoi(arg.c_str() + 12);
+            if (!valid_cell_bits(cell_bits)) {
+                std::cerr << "Error: cell width must be 8, 16 or 32 bits\n";
+                return 1;
+            }
+        } else if (arg.rfind("--tape-size=", 0) == 0) {
+            char* suffix = nullptr;
+            uint64_t size = std::strtoull(arg.c_str() + 12, &suffix, 10);
+            int shift = *suffix == 'K' ? 10 : *suffix == 'M' ? 20 : *suffix == 'G' ? 30 : 0;
+            uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+            if (size < 1 || (shift && suffix[1]) || (!shift && *suffix) || size > (uint64_t(SIZE_MAX) >> shift) / 2) {
+                std::cerr << "Error: --tape-size needs a positive number of bytes\n";
+                return 1;
+            }
+            Tape::size = size_t(((size << shift) + page - 1) / page * page);
+        } else if (arg == "--engine=switch") {
+            engine = ENGINE_SWITCH;
+        } else if (arg == "--engine=threaded") {
+            if (!BF_HAVE_THREADED) {
+                std::cerr << "Error: threaded engine is not supported by this compiler\n";
+                return 1;
+            }
+            engine = ENGINE_THREADED;
+        } else if (arg == "--engine=jit" || arg == "--jit") {
+            if (!BF_HAVE_JIT) {
+                std::cerr << "Error: JIT is only supported on x86-64 Linux\n";
+                return 1;
+            }
+            engine = ENGINE_JIT;
+        } else if (arg == "--engine=tiered") {
+            if (!BF_HAVE_JIT) {
+                std::cerr << "Error: JIT is only supported on x86-64 Linux\n";
+                return 1;
+            }
+            engine = ENGINE_TIERED;
+        } else if (arg.rfind("--tier-threshold=", 0) == 0) {
+            tier_threshold = uint32_t(std::atol(arg.c_str() + 17));
+            if (tier_threshold < 1) {
+                std::cerr << "Error: --tier-threshold needs a positive count\n";
+                return 1;
+            }
+        } else if (arg.rfind("--max-iterations=", 0) == 0) {
+            watchdog.max_iterations = std::strtoull(arg.c_str() + 17, nullptr, 10);
+            if (watchdog.max_iterations < 1) {
+                std::cerr << "Error: --max-iterations needs a positive count\n";
+                return 1;
+            }
+        } else if (arg.rfind("--timeout=", 0) == 0) {
+            watchdog.timeout = std::atof(arg.c_str() + 10);
+            if (!(watchdog.timeout > 0)) {
+                std::cerr << "Error: --timeout needs a positive number of seconds\n";
+                return 1;
+            }
+        } else if (arg.rfind("--checkpoint=", 0) == 0 && arg.size() > 13) {
+            watchdog.checkpoint_path = arg.substr(13);
+        } else if (arg.rfind("--checkpoint-every=", 0) == 0) {
+            watchdog.checkpoint_every = std::strtoull(arg.c_str() + 19, nullptr, 10);
+            if (watchdog.checkpoint_every < 1) {
+                std::cerr << "Error: --checkpoint-every needs a positive count\n";
+                return 1;
+            }
+        } else if (arg.rfind("--resume=", 0) == 0 && arg.size() > 9) {
+            resume_file = arg.substr(9);
+        } else if (arg == "--bench" || arg == "--bench=csv" || arg == "--bench=json") {
+            bench = true;
+            bench_options.json = arg == "--bench=json";
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            bench_options.repeat = std::atoi(arg.c_str() + 9);
+            if (bench_options.repeat < 1) {
+                std::cerr << "Error: --repeat needs a positive count\n";
+                return 1;
+            }
+        } else if (arg.rfind("--bench-input=", 0) == 0 && arg.size() > 14) {
+            bench_options.input_file = arg.substr(14);
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            int jobs = std::atoi(arg.c_str() + 7);
+            if (jobs < 1) {
+                std::cerr << "Error: --jobs needs a positive count\n";
+                return 1;
+            }
+            batch_options.jobs = unsigned(jobs);
+        } else if (arg.rfind("--batch-output=", 0) == 0 && arg.size() > 15) {
+            batch_options.output_dir = arg.substr(15);
+        } else if (arg == "--fuzz" || arg.rfind("--fuzz=", 0) == 0) {
+            fuzz = true;
+            if (arg.size() > 6) {
+                fuzz_options.count = std::strtoull(arg.c_str() + 7, nullptr, 10);
+                if (fuzz_options.count < 1) {
+                    std::cerr << "Error: --fuzz needs a positive count\n";
+                    return 1;
+                }
+            }
+        } else if (arg.rfind("--seed=", 0) == 0 && arg.size() > 7) {
+            fuzz_options.seed = std::strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg[0] != '-' || arg.size() == 1) {
+            program_files.push_back(arg);
+        } else {
+            std::cerr << "Error: unknown option " << arg << "\n" << usage;
+            return 1;
+        }
+    }
+    if (fuzz)
+        return run_fuzz(fuzz_options);
+    if (program_files.empty()) {
+        std::cerr << usage;
+        return 1;
+    }
+    PassManager pass_manager(opt_level, cell_bits);
+    std::string unknown_pass = apply_pass_args(pass_manager, pass_args);
+    if (!unknown_pass.empty()) {
+        std::cerr << "Error: unknown pass " << unknown_pass << "\n" << usage;
+        return 1;
+    }
+
+    if (bench) {
+        bench_options.files = program_files;
+        bench_options.pass_args = pass_args;
+        bench_options.cell_bits = cell_bits;
+        bench_options.eof_mode = eof_mode;
+        bench_options.tier_threshold = tier_threshold;
+        return run_bench(bench_options);
+    }
+    if (batch && (profiling || stats_enabled || print_bytecode || !emit_file.empty() || !emit_c_file.empty())) {
+        std::cerr << "Error: --batch cannot be combined with --profile, --stats, -c, --emit or --emit-c\n";
+        return 1;
+    }
+    if (watchdog.checkpoint_every && watchdog.checkpoint_path.empty()) {
+        std::cerr << "Error: --checkpoint-every needs --checkpoint\n";
+        return 1;
+    }
+    if (checked && (engine == ENGINE_JIT || engine == ENGINE_TIERED || profiling)) {
+        std::cerr << "Error: --checked needs the switch or threaded engine and cannot be combined with --profile\n";
+        return 1;
+    }
+    bool checkpointed = !watchdog.checkpoint_path.empty() || !resume_file.empty();
+    if (checkpointed && (batch || ((engine == ENGINE_JIT || engine == ENGINE_TIERED) && !profiling))) {
+        std::cerr << "Error: --checkpoint and --resume need the switch or threaded engine and a single run\n";
+        return 1;
+    }
+    if (program_files.size() > 1 && !batch) {
+        std::cerr << "Error: unknown option " << program_files[1] << "\n" << usage;
+        return 1;
+    }
+    const std::string& program_file = program_files[0];
+
+    // The program comes from a .bfc file, the cache, or the compiler and pass manager. The tiered
+    // engine starts from the cheap -O1 passes and applies `pass_manager` to hot loops itself, unless
+    // the bytecode is also written out, which gets the full passes. The cache key is the signature of
+    // the passes that ran, so a tiered run caches its startup bytecode under the key of an -O1 run.
+    PassManager startup_passes(std::min(opt_level, 1), cell_bits);
+    bool startup_only = engine == ENGINE_TIERED && emit_file.empty() && emit_c_file.empty();
+    PassManager& build_passes = startup_only ? startup_passes : pass_manager;
+    // Reading, mapping and compiling count as compile time for --stats, the passes as optimize time
+    Stats stats;
+    MappedBytecode mapped;
+    std::vector<Instruction> bytecode;
+    std::span<const Instruction> program;
+    LoadResult loaded = LOAD_NOT_BYTECODE;
+    stats.compile_seconds += seconds([&] { loaded = program_file == "-" ? LOAD_NOT_BYTECODE : mapped.map(program_file); });
+    if (loaded == LOAD_INVALID) {
+        std::cerr << "Error: " << program_file << " is not a valid bytecode file for this build\n";
+        return 1;
+    }
+    if (loaded == LOAD_OK) {
+        program = mapped.code();
+        cell_bits = int(mapped.header().cell_bits);
+    } else if (!cache_dir.empty()) {
+        std::string source;
+        uint64_t key = 0;
+        std::string path;
+        bool hit = false;
+        stats.compile_seconds += seconds([&] {
+            source = read_program(program_file);
+            key = bytecode_key(source, build_passes.signature());
+            char name[32];
+            snprintf(name, sizeof(name), "/%016llx.bfc", static_cast<unsigned long long>(key));
+            path = cache_dir + name;
+            hit = mapped.map(path) == LOAD_OK && mapped.header().key == key;
+        });
+        if (hit) {
+            program = mapped.code();
+        } else {
+            stats.compile_seconds += seconds([&] { bytecode = compile_to_bytecode(source); });
+            stats.optimize_seconds = seconds([&] { build_passes.run(bytecode); });
+            write_bytecode(path, bytecode, key, cell_bits);  // a failed write only costs the next run a compile
+            program = bytecode;
+        }
+    } else {
+        stats.compile_seconds += seconds([&] { bytecode = compile_file(program_file); });
+        stats.optimize_seconds = seconds([&] { build_passes.run(bytecode); });
+        program = bytecode;
+    }
+    if (time_passes)
+        build_passes.print_report(std::cerr);
+
+    if (!emit_file.empty() && !write_bytecode(emit_file, program, 0, cell_bits)) {
+        std::cerr << "Error: Cannot write " << emit_file << std::endl;
+        return 1;
+    }
+    if (!emit_c_file.empty()) {
+        std::ofstream c_file(emit_c_file);
+        emit_c(c_file, program, cell_bits, eof_mode);
+        if (!c_file.flush()) {
+            std::cerr << "Error: Cannot write " << emit_c_file << std::endl;
+            return 1;
+        }
+    }
+
+    // With a watchdog, loops that can never end once entered stop the run as soon as they are entered
+    if (watchdog.enabled() && emit_file.empty() && emit_c_file.empty()) {
+        std::vector<Instruction> trapped(program.begin(), program.end());
+        for (int position : trap_endless_loops(trapped))
+            std::cerr << "Warning: the loop at position " << position << " can run forever\n";
+        if (trapped.size() != program.size()) {
+            bytecode = std::move(trapped);
+            program = bytecode;
+        }
+    }
+    if (checked && emit_file.empty() && emit_c_file.empty()) {
+        std::vector<Instruction> with_checks(program.begin(), program.end());
+        insert_range_checks(with_checks);
+        bytecode = std::move(with_checks);
+        program = bytecode;
+    }
+
+    if (print_bytecode) { // Output the bytecode instead of executing
+        for (const Instruction& instr : program) {
+            print_instruction(std::cout, instr);
+            std::cout << " ";
+        }
+        std::cout << std::endl;
+    } else if (emit_file.empty() && emit_c_file.empty()) { // Execute the bytecode
+        if ((engine == ENGINE_JIT || engine == ENGINE_TIERED) && cell_bits != 8 && !profiling) {
+            std::cerr << "Error: the JIT supports 8-bit cells only\n";
+            return 1;
+        }
+        if (batch) {
+            batch_options.inputs.assign(program_files.begin() + 1, program_files.end());
+            batch_options.engine = engine;
+            batch_options.cell_bits = cell_bits;
+            batch_options.eof_mode = eof_mode;
+            batch_options.tier_passes = &pass_manager;
+            batch_options.tier_threshold = tier_threshold;
+            batch_options.limits = watchdog;
+            return run_batch(program, batch_options);
+        }
+        watchdog.code_hash = bytecode_hash(program, cell_bits);
+        if (!resume_file.empty()) {
+            if (!read_checkpoint(resume_file, checkpoint)) {
+                std::cerr << "Error: " << resume_file << " is not a valid checkpoint file" << std::endl;
+                return 1;
+            }
+            if (checkpoint.header.code_hash != watchdog.code_hash || checkpoint.header.pc >= program.size()) {
+                std::cerr << "Error: " << resume_file << " was written for another program or options" << std::endl;
+                return 1;
+            }
+            watchdog.resume = &checkpoint;
+            resume_streams(checkpoint.header);
+        }
+        if (!watchdog.checkpoint_path.empty())
+            Watchdog::catch_signals();
+        IO io(STDIN_FILENO, STDOUT_FILENO, eof_mode);
+        std::unique_ptr<Profile> profile(profiling ? new Profile(program.size()) : nullptr);
+        Stats* run_stats = stats_enabled ? &stats : nullptr;
+        if (watchdog.watching()) {
+            watchdog.arm();
+            io.watchdog = &watchdog;
+        }
+        stats.execute_seconds = seconds([&] {
+#if BF_HAVE_JIT
+            if (engine == ENGINE_TIERED && !profile)
+                interpret_tiered(program, io, pass_manager, tier_threshold, run_stats);
+            else
+#endif
+            if (cell_bits == 16)
+                execute<uint16_t>(engine, program, io, profile.get(), run_stats);
+            else if (cell_bits == 32)
+                execute<uint32_t>(engine, program, io, profile.get(), run_stats);
+            else
+                execute<uint8_t>(engine, program, io, profile.get(), run_stats);
+            io.out.flush();
+        });
+        stats.bytes_in = io.in.bytes_read();
+        stats.bytes_out = io.out.bytes_written();
+        if (profile)
+            print_profile(std::cerr, program, *profile);
+    }
+    if (stats_enabled) {
+        const char* engine_name = engine_names[profiling && !print_bytecode ? ENGINE_SWITCH : engine];
+        if (stats_file.empty()) {
+            print_stats(std::cerr, stats, engine_name, cell_bits, program.size());
+        } else {
+            std::ofstream file(stats_file);
+            print_stats(file, stats, engine_name, cell_bits, program.size());
+            if (!file.flush()) {
+                std::cerr << "Error: Cannot write " << stats_file << std::endl;
+                return 1;
             }
         }
-        std::cout << std::endl;
-    } else { // Execute the bytecode
-        interpret_bytecode(bytecode);
     }
     return 0;
 }
+#endif  // BF_NO_MAIN
@@ -51,6 +51,7 @@ CC=gcc CXX=g++ CFLAGS="-O3 -std=gnu11" CXXFLAGS="-O3 -std=c++20" make brainfuck
 testcase "+." <(echo "+.") cmp <(echo -ne '\x01')
 testcase "+-." <(echo "+-.") cmp <(echo -ne '\x00')
 testcase "+>." <(echo "+>.") cmp <(echo -ne '\x00')
+testcase "unmatched brackets" <(echo "[]]+[.") cmp <(echo -ne '\x01')
 
 testcase "3434" <(base64 -d <<EOF | gunzip
 H4sIAAAAAAAAA9PWJhnYka5FW9tGz04PhLkAIcEna3EAAAA=
@@ -58,6 +59,50 @@ EOF
 ) cmp <(echo -n "3434")
 
 testcase "scrub right" <(echo ">+>->->+<[[-]<].>.>.>.>.") cmp <(echo -ne '\x00\x00\x00\x00\x01')
+testcase "multiply loop" <(echo "++++++++[->++++++++>+++<<]>+.>.") cmp <(echo -ne 'A\x18')
+testcase "offsets" <(echo "+++>++>+<<[>.<-]>>.<<.[-][-]>.") cmp <(echo -ne '\x02\x02\x02\x01\x00\x02')
+testcase "scan" <(echo ">+>+>+>+>+<<<<[>]+[<]>.>+>>+>>+>>+<<<<<<[>>]+.") cmp <(echo -ne '\x01\x01')
+if ./brainfuck --engine=jit <(echo "+[<<]+.") > /dev/null 2>&1; then echo "FAILED: jit scan off tape"; FAILED=1; fi
+testcase "counter steps" <(echo ",[--->+<]>.<,[-->++<]>.<,[+]+.") cmp <(echo -ne '\x16X\x01') <<< "BBB"
+testcase "known cells" <(echo "[.]++[->+++<]>[<+>>+<-]<.>[.]>.") cmp <(echo -ne '\x06\x06')
+testcase "vector add" <(echo ",>+>+>+>+<<<<[->--->--->--->---<<<<]>.>.>.>.") cmp <(echo -ne ';;;;') <<< "B"
+./brainfuck -O3 <(echo "++++++++[->++++++++<]>+.>+++[<+>-]<,.") <<< "B" | cmp - <(echo -n "AB") || (echo "FAILED: prefix"; FAILED=1)
+
+testcase "long tape" <(printf '>%.0s' {1..40000}; echo "+.") cmp <(echo -ne '\x01')
+./brainfuck --checked <(echo ">+>+>+>+>+<<<<[>]+[<]>.>+>>+>>+>>+<<<<<<[>>]+.<+[<]<+.") | cmp - <(echo -ne '\x01\x01\x03') || (echo "FAILED: checked"; FAILED=1)
+if ./brainfuck --checked <(echo "+[>+]") > /dev/null 2>&1; then echo "FAILED: checked off tape"; FAILED=1; fi
+if ./brainfuck <(echo "<+") > /dev/null 2>&1; then echo "FAILED: left of cell 0"; FAILED=1; fi
+if ./brainfuck --eof=unchanged <(echo "<,") < /dev/null > /dev/null 2>&1; then echo "FAILED: input left of cell 0"; FAILED=1; fi
+if ./brainfuck --tape-size=4K <(printf '>%.0s' {1..40000}; echo "+.") > /dev/null 2>&1; then echo "FAILED: tape size"; FAILED=1; fi
+
+./brainfuck --fuzz=2000 > /dev/null || (echo "FAILED: fuzz"; FAILED=1)
+
+./brainfuck --cell-bits=16 <(echo "++++++++[>++++++++<-]>[>++++<-]>[<+>[-]]<.") | cmp - <(echo -ne '\x01') || (echo "FAILED: 16-bit cells"; FAILED=1)
+
+./brainfuck --profile <(echo "++++++++[->++++++++>+++<<]>+.>.") 2>/dev/null | cmp - <(echo -ne 'A\x18') || (echo "FAILED: profile"; FAILED=1)
+./brainfuck --max-iterations=4 <(echo "+++++[-.]") | cmp - <(echo -ne '\x04\x03\x02\x01\x00') || (echo "FAILED: iteration limit"; FAILED=1)
+if ./brainfuck --max-iterations=3 <(echo "+++++[-.]") > /dev/null 2>&1; then echo "FAILED: iteration limit exceeded"; FAILED=1; fi
+if ./brainfuck --timeout=60 <(echo "+[>+<]") > /dev/null 2>&1; then echo "FAILED: endless loop"; FAILED=1; fi
+grep -q "endless loop at position 6$" <(./brainfuck --max-iterations=100 <(echo ",>>>>,[--<<++>>]") <<< "aa" 2>&1) || (echo "FAILED: even-step loop position"; FAILED=1)
+ckpt=$(mktemp -d)
+./brainfuck --checkpoint="$ckpt/state" --checkpoint-every=20 <(echo "++++++++[->++++++++<]>[-.>+<]>.,.") <<< "x" > "$ckpt/out"
+./brainfuck --resume="$ckpt/state" <(echo "++++++++[->++++++++<]>[-.>+<]>.,.") <<< "x" >> "$ckpt/out"
+./brainfuck <(echo "++++++++[->++++++++<]>[-.>+<]>.,.") <<< "x" | cmp - "$ckpt/out" || (echo "FAILED: checkpoint"; FAILED=1)
+rm -rf "$ckpt"
+stats=$(mktemp)
+./brainfuck --engine=switch --stats-output="$stats" <(echo "++++++++[->++++++++>+++<<]>+.>.,.") <<< "x" | cmp - <(echo -ne 'A\x18x') || (echo "FAILED: stats"; FAILED=1)
+grep -q '"instructions": 10, "loop_iterations": 0, .*"bytes_in": 1, "bytes_out": 3' "$stats" || (echo "FAILED: stats counters"; FAILED=1)
+rm -f "$stats"
+bfc=$(mktemp)
+./brainfuck --emit="$bfc" <(echo "++++++++[->++++++++>+++<<]>+.>.")
+testcase "bytecode file" "$bfc" cmp <(echo -ne 'A\x18')
+./brainfuck --batch --eof=0 <(echo ",[+.,]") <(echo -n "ab") <(echo -n "cd") | cmp - <(echo -n "bcde") || (echo "FAILED: batch"; FAILED=1)
+if batch=$(./brainfuck --batch --eof=0 --jobs=1 <(echo ",[.,]+[<<]") <(echo -n "ab") <(echo -n "cd") 2> /dev/null) || [ "$batch" != "abcd" ]; then echo "FAILED: batch job off tape"; FAILED=1; fi
+csrc=$(mktemp -d)
+./brainfuck --eof=0 --emit-c="$csrc/prog.c" <(echo "++++++++[->++++++++>+++<<]>+.>.,[+.,]+[")
+gcc -O3 -std=gnu11 -o "$csrc/prog" "$csrc/prog.c"
+"$csrc/prog" <<< "x" | cmp - <(echo -ne 'A\x18y\x0b') || (echo "FAILED: emit-c"; FAILED=1)
+rm -rf "$bfc" "$csrc"
 
 testcase "helloworld" <(base64 -d <<EOF | gunzip
 H4sIAAAAAAAAAzWLyQ0AIQwD/7QS2RWgaQTRfxvrLGDJzuSqOlq8bDiekTaFYmrN3S0GSb6PbjDO